@@ -52,14 +52,18 @@
 #define UTIL_WEIGHT .60
 
 /*
- * Alignment requirement in bytes
+ * Alignment requirement in bytes (the mm package follows it too, so
+ * -DALIGNMENT=n builds a driver and an allocator for another alignment)
  */
+#ifndef ALIGNMENT
 #define ALIGNMENT 16
+#endif
 
 /*
  * Maximum heap size in bytes
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#define MAX_ARENAS 8           /* independent heaps memlib can model */
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
@@ -144,7 +144,7 @@ int main(int argc, char **argv)
     trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
-    stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    stats_t *mm_results = NULL;/* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
@@ -251,9 +251,9 @@ int main(int argc, char **argv)
         printf("\nTesting mm malloc\n");
 
     /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-        unix_error("mm_stats calloc in main failed");
+    mm_results = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+    if (mm_results == NULL)
+        unix_error("mm_results calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
@@ -261,19 +261,19 @@ int main(int argc, char **argv)
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
         trace = read_trace(tracedir, tracefiles[i]);
-        mm_stats[i].ops = trace->num_ops;
+        mm_results[i].ops = trace->num_ops;
         if (verbose > 1)
             printf("Checking mm_malloc for correctness, ");
-        mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-        if (mm_stats[i].valid) {
+        mm_results[i].valid = eval_mm_valid(trace, i, &ranges);
+        if (mm_results[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+            mm_results[i].util = eval_mm_util(trace, i, &ranges);
             speed_params.trace = trace;
             speed_params.ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+            mm_results[i].secs = fsecs(eval_mm_speed, &speed_params);
         }
         free_trace(trace);
     }
@@ -281,7 +281,7 @@ int main(int argc, char **argv)
     /* Display the mm results in a compact table */
     if (verbose) {
         printf("\nResults for mm malloc:\n");
-        printresults(num_tracefiles, mm_stats);
+        printresults(num_tracefiles, mm_results);
         printf("\n");
     }
 
@@ -293,10 +293,10 @@ int main(int argc, char **argv)
     util = 0;
     numcorrect = 0;
     for (i=0; i < num_tracefiles; i++) {
-        secs += mm_stats[i].secs;
-        ops += mm_stats[i].ops;
-        util += mm_stats[i].util;
-        if (mm_stats[i].valid)
+        secs += mm_results[i].secs;
+        ops += mm_results[i].ops;
+        util += mm_results[i].util;
+        if (mm_results[i].valid)
             numcorrect++;
     }
     avg_mm_util = util/num_tracefiles;
@@ -366,9 +366,11 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or within
+     * one of the regions memlib has mapped */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_is_mapped(lo, hi)) {
         sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
                 lo, hi, mem_heap_lo(), mem_heap_hi());
         malloc_error(tracenum, opnum, msg);
@@ -447,7 +449,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     FILE *tracefile;
     trace_t *trace;
     char type[MAXLINE];
-    char path[MAXLINE];
+    char path[MAXLINE / 2]; // hack to get rid of overflow warning in the sprintf below
     int index, size;
     int max_index = 0;
     int op_index;
@@ -625,7 +627,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
             oldsize = trace->block_sizes[index];
             if (size < oldsize) oldsize = size;
             for (j = 0; j < oldsize; j++) {
-                if (newp[j] != (index & 0xFF)) {
+                if ((unsigned char)newp[j] != (index & 0xFF)) {
                     malloc_error(tracenum, i, "mm_realloc did not preserve the "
                                  "data from old block");
                     return 0;
@@ -660,12 +662,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
- *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
+ *   Utilization is the ratio hwm/footprint, where footprint is the
+ *   largest number of bytes in the heap plus the regions memlib has
+ *   mapped while running the student's malloc package on the trace.
+ *   mem_sbrk() lets the package shrink the heap and regions can be
+ *   unmapped, so the final footprint may be well below that peak.
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
@@ -746,7 +747,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_footprint());
 }
 
 
@@ -1,12 +1,13 @@
 /*
  * mdriver.c - CS 208 Lab 4 Driver
  *
- * Uses a collection of trace files to tests a malloc/free
+ * Uses a collection of trace files to tests a malloc/free/realloc
  * implementation in mm.c.
  *
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,11 +16,27 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -29,6 +46,14 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define RES_SAMPLES   10 /* points in time of the resident bytes report */
+#define LAT_SUB_BITS   4 /* log2 of the latency buckets per power of two */
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS (64 * LAT_SUB) /* enough for any 64-bit cycle count */
+#define MAX_THREADS   64 /* most threads the -T mode runs */
+
+/* Thread counts of the -T mode: doubling, but always ending at max */
+#define NEXT_THREADS(n, max) (((n) < (max) && 2*(n) > (max)) ? (max) : 2*(n))
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
@@ -37,29 +62,28 @@
  * The key compound data types
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a splay tree
+   keyed by lo. Payloads never overlap, so the order by lo is also the
+   order by hi */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* payloads below this one */
+    struct range_t *right; /* payloads above this one */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc ids */
+    int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc */
+    traceop_t *ops;      /* array of requests (see trace.h) */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* a binary trace file mapped in full, which ops
+                            points into, or NULL if ops was allocated */
+    size_t map_size;     /* bytes of that mapping */
 } trace_t;
 
 /*
@@ -72,10 +96,19 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+#ifdef MM_THREADS
+/* One thread of the -T mode, replaying a trace with blocks of its own */
+typedef struct {
+    trace_t *trace;
+    char **blocks;       /* this thread's ptrs returned by malloc/realloc */
+    int failed;          /* set if the heap ran out of memory */
+} worker_t;
+#endif
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
-    double ops;      /* number of ops (malloc/free) in the trace */
+    double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
 
@@ -85,11 +118,32 @@ typedef struct {
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/* What a -j worker process sends back about its trace */
+typedef struct {
+    int tracenum;    /* the trace it ran */
+    int errors;      /* errors it found */
+    stats_t stats;   /* the results */
+} job_result_t;
+
+/* Latencies of one kind of request in the -L report, an HDR-style
+   histogram: values below LAT_SUB have a bucket each, and every power
+   of two above gets LAT_SUB buckets, so a bucket is never more than
+   1/LAT_SUB of its values wide */
+typedef struct {
+    unsigned long counts[LAT_BUCKETS]; /* requests per bucket */
+    unsigned long total;               /* requests in all buckets */
+    unsigned long long max;            /* slowest request (cycles)... */
+    int max_op;                        /* ...and its index in the trace */
+} lat_hist_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int check_heaps = 0; /* check the mm heap after each trace (set by -c) */
+static int jobs = 1;        /* traces run at once, in worker processes (set by -j) */
+static int jobs_timed = 0;  /* time the traces in the workers too (set by -J) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -100,6 +154,49 @@ static char *default_tracefiles[] = {
                                      DEFAULT_TRACEFILES, NULL
 };
 
+/* Names of the mm placement policies, indexed by MM_FIT_xxx */
+static char *fit_names[MM_NUM_FITS] = {
+    "first", "next", "best", "bestN"
+};
+
+/* Names of the mm coalescing modes, indexed by MM_COALESCE_xxx */
+static char *coalesce_names[] = {
+    "immediate", "deferred"
+};
+
+/* Names of the trace requests, indexed by ALLOC, FREE and REALLOC */
+static char *op_names[] = {
+    "malloc", "free", "realloc"
+};
+
+/* Names of the mm free list orders, indexed by MM_ORDER_xxx */
+static char *order_names[] = {
+    "lifo", "address"
+};
+
+#ifdef __linux__
+/* The events counted by the -C report */
+typedef struct {
+    char *name;          /* column heading */
+    unsigned int type;   /* PERF_TYPE_xxx */
+    unsigned long config;/* which event of that type */
+} perf_event_t;
+
+#define HW_CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static perf_event_t perf_events[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"l1d-miss", PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {"llc-refs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"llc-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"dtlb-miss", PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {"faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}
+};
+#define NUM_PERF_EVENTS (int)(sizeof(perf_events) / sizeof(perf_events[0]))
+#endif
+
 
 /*********************
  * Function prototypes
@@ -110,10 +207,13 @@ static int add_range(range_t **ranges, char *lo, int size,
                      int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *splay_range(range_t *t, char *lo);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
+static void parse_trace(trace_t *trace, FILE *tracefile, char *path);
+static void map_trace(trace_t *trace, FILE *tracefile, char *path);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -124,6 +224,34 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_traces(char **tracefiles, int num_tracefiles,
+                           stats_t *stats, range_t **ranges);
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+                          range_t **ranges, int check, int timed);
+static void eval_libc_traces(char **tracefiles, int num_tracefiles,
+                             stats_t *stats);
+static void eval_libc_trace(char *tracefile, int tracenum, stats_t *stats,
+                            int check, int timed);
+static void eval_jobs(char **tracefiles, int num_tracefiles, stats_t *stats,
+                      int libc);
+static void pin_cpu(int slot);
+static void eval_mm_compare(char *what, int param, char **names, int n,
+                            char **tracefiles, int num_tracefiles,
+                            range_t **ranges);
+static int parse_fit(char *name);
+static void eval_mm_resident(char **tracefiles, int num_tracefiles);
+static void eval_mm_stats(char **tracefiles, int num_tracefiles);
+static void eval_mm_perf(char **tracefiles, int num_tracefiles);
+static void eval_mm_latency(char **tracefiles, int num_tracefiles);
+static unsigned long long read_cycles(void);
+static void lat_record(lat_hist_t *hist, unsigned long long cycles, int opnum);
+static unsigned long long lat_percentile(lat_hist_t *hist, double p);
+static void replay_op(trace_t *trace, int opnum, char *caller);
+#ifdef MM_THREADS
+static void eval_mm_threads(char **tracefiles, int num_tracefiles,
+                            int max_threads);
+static void *eval_mm_worker(void *arg);
+#endif
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
@@ -141,15 +269,24 @@ int main(int argc, char **argv)
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
-    stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */
+    stats_t *mm_results = NULL;/* mm (i.e. student) stats for each trace */
+    int fit;                   /* placement policy picked with -p */
 
     int team_check = 0;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int compare_fits = 0;/* If set, compare all mm placement policies (-P) */
+    int compare_coalesce = 0; /* If set, compare mm coalescing modes (-D) */
+    int compare_orders = 0;   /* If set, compare mm free list orders (-O) */
+    int show_resident = 0;    /* If set, report mm heap size over time (-r) */
+    int show_stats = 0;       /* If set, report mm counters for each trace (-s) */
+    int show_perf = 0;        /* If set, report cache misses for each trace (-C) */
+    int show_latency = 0;     /* If set, report request latencies for each trace (-L) */
+#ifdef MM_THREADS
+    int max_threads = 0;      /* If set, run traces in up to this many threads (-T) */
+#endif
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +295,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:p:m:T:c:w:G:j:hvVgalPdDoOSrsCJL")) != EOF) {
         switch (c) {
         case 'g': /* Generate summary info for the autograder */
             autograder = 1;
@@ -184,6 +321,87 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'p': /* Placement policy of the mm package */
+            if ((fit = parse_fit(optarg)) < 0 ||
+                mm_config(MM_FIT_POLICY, fit) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'm': /* Size from which the mm package maps a region per block */
+            if (mm_config(MM_MAP, atol(optarg)) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'c': /* Have the mm package check its heap every n requests */
+            if (mm_config(MM_CHECK, atol(optarg)) < 0) {
+                usage();
+                exit(1);
+            }
+            check_heaps = 1;
+            break;
+        case 'w': /* Blocks of the heap walked per check */
+            if (mm_config(MM_CHECK_WINDOW, atol(optarg)) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'G': /* Guard pages after the blocks of some size classes */
+            if (mm_config(MM_GUARD, strtol(optarg, NULL, 0)) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'P': /* Compare all placement policies of the mm package */
+            compare_fits = 1;
+            break;
+        case 'd': /* Deferred coalescing in the mm package */
+            mm_config(MM_COALESCE, MM_COALESCE_DEFERRED);
+            break;
+        case 'D': /* Compare immediate and deferred coalescing */
+            compare_coalesce = 1;
+            break;
+        case 'o': /* Address ordered free lists in the mm package */
+            mm_config(MM_ORDER, MM_ORDER_ADDRESS);
+            break;
+        case 'O': /* Compare LIFO and address ordered free lists */
+            compare_orders = 1;
+            break;
+        case 'S': /* Reserve room after blocks that realloc grows */
+            mm_config(MM_REALLOC_SLACK, 1);
+            break;
+        case 'r': /* Report the resident bytes over time */
+            show_resident = 1;
+            break;
+        case 's': /* Report the counters of the mm package */
+            show_stats = 1;
+            break;
+        case 'C': /* Report cache misses and other perf counters */
+            show_perf = 1;
+            break;
+        case 'L': /* Report the latency percentiles of the requests */
+            show_latency = 1;
+            break;
+        case 'T': /* Run the traces in several threads at once */
+#ifdef MM_THREADS
+            max_threads = atoi(optarg);
+            if (max_threads >= 1 && max_threads <= MAX_THREADS)
+                break;
+#else
+            fprintf(stderr, "-T needs a thread-safe build (make mdriver-mt)\n");
+#endif
+            usage();
+            exit(1);
+        case 'j': /* Run the traces in several worker processes at once */
+            if ((jobs = atoi(optarg)) < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'J': /* Time the traces in the workers as well */
+            jobs_timed = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -251,20 +469,7 @@ int main(int argc, char **argv)
             unix_error("libc_stats calloc in main failed");
 
         /* Evaluate the libc malloc package using the K-best scheme */
-        for (i=0; i < num_tracefiles; i++) {
-            trace = read_trace(tracedir, tracefiles[i]);
-            libc_stats[i].ops = trace->num_ops;
-            if (verbose > 1)
-                printf("Checking libc malloc for correctness, ");
-            libc_stats[i].valid = eval_libc_valid(trace, i);
-            if (libc_stats[i].valid) {
-                speed_params.trace = trace;
-                if (verbose > 1)
-                    printf("and performance.\n");
-                libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-            }
-            free_trace(trace);
-        }
+        eval_libc_traces(tracefiles, num_tracefiles, libc_stats);
 
         /* Display the libc results in a compact table */
         if (verbose) {
@@ -280,40 +485,60 @@ int main(int argc, char **argv)
         printf("\nTesting mm malloc\n");
 
     /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-        unix_error("mm_stats calloc in main failed");
+    mm_results = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+    if (mm_results == NULL)
+        unix_error("mm_results calloc in main failed");
 
     /* Initialize the simulated memory system in memlib.c */
     mem_init();
 
+    /* Optionally run every placement policy and compare them */
+    if (compare_fits)
+        eval_mm_compare("placement policy", MM_FIT_POLICY, fit_names,
+                        MM_NUM_FITS, tracefiles, num_tracefiles, &ranges);
+
+    /* Optionally run both coalescing modes and compare them */
+    if (compare_coalesce)
+        eval_mm_compare("coalescing mode", MM_COALESCE, coalesce_names,
+                        2, tracefiles, num_tracefiles, &ranges);
+
+    /* Optionally run both free list orders and compare them */
+    if (compare_orders)
+        eval_mm_compare("free list order", MM_ORDER, order_names,
+                        2, tracefiles, num_tracefiles, &ranges);
+
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-        trace = read_trace(tracedir, tracefiles[i]);
-        mm_stats[i].ops = trace->num_ops;
-        if (verbose > 1)
-            printf("Checking mm_malloc for correctness, ");
-        mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-        if (mm_stats[i].valid) {
-            if (verbose > 1)
-                printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-            speed_params.trace = trace;
-            speed_params.ranges = ranges;
-            if (verbose > 1)
-                printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-        }
-        free_trace(trace);
-    }
+    eval_mm_traces(tracefiles, num_tracefiles, mm_results, &ranges);
 
     /* Display the mm results in a compact table */
     if (verbose) {
         printf("\nResults for mm malloc:\n");
-        printresults(num_tracefiles, mm_stats);
+        printresults(num_tracefiles, mm_results);
         printf("\n");
     }
 
+    /* Optionally show how the heap grows and shrinks during each trace */
+    if (show_resident)
+        eval_mm_resident(tracefiles, num_tracefiles);
+
+    /* Optionally show the free space and fragmentation of each trace */
+    if (show_stats)
+        eval_mm_stats(tracefiles, num_tracefiles);
+
+    /* Optionally count the cache misses the package causes on each trace */
+    if (show_perf)
+        eval_mm_perf(tracefiles, num_tracefiles);
+
+    /* Optionally find the slow requests of each trace */
+    if (show_latency)
+        eval_mm_latency(tracefiles, num_tracefiles);
+
+#ifdef MM_THREADS
+    /* Optionally see how throughput scales with threads */
+    if (max_threads)
+        eval_mm_threads(tracefiles, num_tracefiles, max_threads);
+#endif
+
     /*
      * Accumulate the aggregate statistics for the student's mm package
      */
@@ -322,10 +547,10 @@ int main(int argc, char **argv)
     util = 0;
     numcorrect = 0;
     for (i=0; i < num_tracefiles; i++) {
-        secs += mm_stats[i].secs;
-        ops += mm_stats[i].ops;
-        util += mm_stats[i].util;
-        if (mm_stats[i].valid)
+        secs += mm_results[i].secs;
+        ops += mm_results[i].ops;
+        util += mm_results[i].util;
+        if (mm_results[i].valid)
             numcorrect++;
     }
     avg_mm_util = util/num_tracefiles;
@@ -368,22 +593,24 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. It is a
+ * splay tree, so each check costs O(log n) amortized and checking
+ * a trace with many live blocks doesn't take quadratic time.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
 static int add_range(range_t **ranges, char *lo, int size,
                      int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *root;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -396,19 +623,26 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or within
+     * one of the regions memlib has mapped */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_is_mapped(lo, hi)) {
         sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
                 lo, hi, mem_heap_lo(), mem_heap_hi());
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
+    /* The payload must not overlap any other payloads. Only the payload
+     * with the highest lo at or below hi can reach into it, since payloads
+     * further down end before that one starts */
+    if ((root = *ranges) != NULL) {
+        p = *ranges = splay_range(root, hi);
+        if (p->lo > hi)     /* the root is the next payload up */
+            for (p = p->left; p != NULL && p->right != NULL; p = p->right)
+                ;
+        if (p != NULL && p->hi >= lo) {
             sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
                     lo, hi, p->lo, p->hi);
             malloc_error(tracenum, opnum, msg);
@@ -418,13 +652,27 @@ static int add_range(range_t **ranges, char *lo, int size,
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree, as
+     * its new root.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
         unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
+    p->left = p->right = NULL;
+    if ((root = *ranges) != NULL) {
+        root = splay_range(root, lo);
+        if (root->lo < lo) {
+            p->left = root;
+            p->right = root->right;
+            root->right = NULL;
+        }
+        else {
+            p->right = root;
+            p->left = root->left;
+            root->left = NULL;
+        }
+    }
     *ranges = p;
     return 1;
 }
@@ -435,18 +683,22 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    // int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            // size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    if (*ranges == NULL)
+        return;
+    p = *ranges = splay_range(*ranges, lo);
+    if (p->lo != lo)
+        return;
+
+    /* Everything on the left is below lo, so splaying it for lo brings
+     * up its highest payload, which has no right child */
+    if (p->left == NULL)
+        *ranges = p->right;
+    else {
+        *ranges = splay_range(p->left, lo);
+        (*ranges)->right = p->right;
     }
+    free(p);
 }
 
 /*
@@ -457,31 +709,89 @@ static void clear_ranges(range_t **ranges)
     range_t *p;
     range_t *pnext;
 
+    /* A splay tree can be as deep as it is big, so rather than recurse,
+     * rotate left children up until the root has none, then free it */
     for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+        if ((pnext = p->left) != NULL) {
+            p->left = pnext->right;
+            pnext->right = p;
+        }
+        else {
+            pnext = p->right;
+            free(p);
+        }
     }
     *ranges = NULL;
 }
 
+/*
+ * splay_range - Top-down splay of the range tree t for key lo. Returns
+ *     the new root, which is the range starting at lo if there is one,
+ *     and otherwise the last range on the search path, i.e. the one just
+ *     below or just above lo.
+ */
+static range_t *splay_range(range_t *t, char *lo)
+{
+    range_t n, *l, *r, *y;
+
+    n.left = n.right = NULL;
+    l = r = &n;
+    for (;;) {
+        if (lo < t->lo) {
+            if (t->left == NULL)
+                break;
+            if (lo < t->left->lo) {    /* rotate right */
+                y = t->left;
+                t->left = y->right;
+                y->right = t;
+                t = y;
+                if (t->left == NULL)
+                    break;
+            }
+            r->left = t;               /* link right */
+            r = t;
+            t = t->left;
+        }
+        else if (lo > t->lo) {
+            if (t->right == NULL)
+                break;
+            if (lo > t->right->lo) {   /* rotate left */
+                y = t->right;
+                t->right = y->left;
+                y->left = t;
+                t = y;
+                if (t->right == NULL)
+                    break;
+            }
+            l->right = t;              /* link left */
+            l = t;
+            t = t->right;
+        }
+        else
+            break;
+    }
+    l->right = t->left;                /* assemble */
+    r->left = t->right;
+    t->left = n.right;
+    t->right = n.left;
+    return t;
+}
+
 
 /**********************************************
  * The following routines manipulate tracefiles
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory, or map it if
+ *     it is a binary trace (see trace.h)
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
     char path[MAXLINE / 2]; // hack to get rid of overflow warning on line 496
-    int index, size;
-    int max_index = 0;
-    int op_index;
-    int scan_result = 1;
+    int magic;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -490,13 +800,47 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trance");
 
-    /* Read the trace file header */
     strcpy(path, tracedir);
     strcat(path, filename);
     if ((tracefile = fopen(path, "r")) == NULL) {
         sprintf(msg, "Could not open %s in read_trace", path);
         unix_error(msg);
     }
+
+    /* A binary trace starts with its magic number, a .rep file with digits */
+    if (fread(&magic, sizeof(magic), 1, tracefile) == 1 && magic == TRACE_MAGIC)
+        map_trace(trace, tracefile, path);
+    else {
+        rewind(tracefile);
+        parse_trace(trace, tracefile, path);
+    }
+    fclose(tracefile);
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks =
+         (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+        unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+         (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in read_trace");
+
+    return trace;
+}
+
+/*
+ * parse_trace - read the header and the requests of a .rep trace
+ */
+static void parse_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    char type[MAXLINE];
+    int index, size;
+    int max_index = 0;
+    int op_index;
+    int scan_result = 1;
+
+    /* Read the trace file header */
     scan_result = scan_result && fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     scan_result = scan_result && fscanf(tracefile, "%d", &(trace->num_ids));
     scan_result = scan_result && fscanf(tracefile, "%d", &(trace->num_ops));
@@ -509,16 +853,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->ops =
          (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks =
-         (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-        unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes =
-         (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-        unix_error("malloc 4 failed in read_trace");
+    trace->map = NULL;
 
     /* read every request line in the trace file */
     index = 0;
@@ -556,20 +891,69 @@ static trace_t *read_trace(char *tracedir, char *filename)
         op_index++;
 
     }
-    fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+}
 
-    return trace;
+/*
+ * map_trace - map a binary trace, whose records serve as the ops array
+ *     as they are. Nothing is parsed or copied, but every record is
+ *     checked once, since a bad index would send the replay outside
+ *     the blocks array; the file may not have come from rep2bin
+ */
+static void map_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    struct stat st;
+    trace_hdr_t *hdr;
+    traceop_t *op;
+    int i;
+
+    if (fstat(fileno(tracefile), &st) < 0 || (size_t)st.st_size < sizeof(trace_hdr_t)) {
+        printf("Truncated binary trace %s\n", path);
+        exit(1);
+    }
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fileno(tracefile), 0);
+    if (trace->map == MAP_FAILED) {
+        sprintf(msg, "Could not map %s in read_trace", path);
+        unix_error(msg);
+    }
+    posix_madvise(trace->map, trace->map_size, POSIX_MADV_SEQUENTIAL);
+
+    hdr = (trace_hdr_t *)trace->map;
+    if (hdr->version != TRACE_VERSION || hdr->num_ops < 0 || hdr->num_ids < 0 ||
+        trace->map_size != sizeof(trace_hdr_t) + (size_t)hdr->num_ops * sizeof(traceop_t)) {
+        printf("Bad header in binary trace %s\n", path);
+        exit(1);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+
+    for (i = 0; i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        if ((op->type != ALLOC && op->type != FREE && op->type != REALLOC) ||
+            op->index < 0 || op->index >= trace->num_ids ||
+            (op->type != FREE && op->size < 0)) {
+            printf("Bad request %d in binary trace %s\n", i, path);
+            exit(1);
+        }
+    }
 }
 
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated (or for a binary
+ *              trace, the ops mapped) in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map)           /* free the three arrays... */
+        munmap(trace->map, trace->map_size);
+    else
+        free(trace->ops);
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -585,9 +969,12 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 {
-    int i;
+    int i, j;
     int index;
     int size;
+    int oldsize;
+    char *newp;
+    char *oldp;
     char *p;
 
     /* Reset the heap and free any records in the range list */
@@ -635,6 +1022,43 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
             trace->block_sizes[index] = size;
             break;
 
+        case REALLOC: /* mm_realloc */
+
+            /* Call the student's realloc */
+            oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp, size)) == NULL) {
+                malloc_error(tracenum, i, "mm_realloc failed.");
+                return 0;
+            }
+
+            /* Remove the old region from the range list */
+            remove_range(ranges, oldp);
+
+            /* Check new block for correctness and add it to range list */
+            if (add_range(ranges, newp, size, tracenum, i) == 0)
+                return 0;
+
+            /* ADDED: cgw
+             * Make sure that the new block contains the data from the old
+             * block and then fill in the new block with the low order byte
+             * of the new index
+             */
+            oldsize = trace->block_sizes[index];
+            if (size < oldsize) oldsize = size;
+            for (j = 0; j < oldsize; j++) {
+                if ((unsigned char)newp[j] != (index & 0xFF)) {
+                    malloc_error(tracenum, i, "mm_realloc did not preserve the "
+                                 "data from old block");
+                    return 0;
+                }
+            }
+            memset(newp, index & 0xFF, size);
+
+            /* Remember region */
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = size;
+            break;
+
         case FREE: /* mm_free */
 
             /* Remove region from list and call student's free function */
@@ -649,6 +1073,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
     }
 
+    /* With -c the package checked itself along the way, now check it all */
+    if (check_heaps && mm_check() < 0) {
+        malloc_error(tracenum, trace->num_ops - 1, "mm_check found a broken heap.");
+        return 0;
+    }
+
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
@@ -657,21 +1087,21 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
- *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
- *
+ *   Utilization is the ratio hwm/footprint, where footprint is the
+ *   largest number of bytes in the heap plus the regions memlib has
+ *   mapped while running the student's malloc package on the trace.
+ *   mem_sbrk() lets the package shrink the heap and regions can be
+ *   unmapped, so the final footprint may be well below that peak.
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {
     int i;
     int index;
-    int size;
+    int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
     char *p;
+    char *newp, *oldp;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
@@ -701,6 +1131,28 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
                 total_size : max_total_size;
             break;
 
+        case REALLOC: /* mm_realloc */
+            index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+            oldsize = trace->block_sizes[index];
+
+            oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+                app_error("mm_realloc failed in eval_mm_util");
+
+            /* Remember region and size */
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
+
+            /* Keep track of current total size
+             * of all allocated blocks */
+            total_size += (newsize - oldsize);
+
+            /* Update statistics */
+            max_total_size = (total_size > max_total_size) ?
+                total_size : max_total_size;
+            break;
+
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             size = trace->block_sizes[index];
@@ -720,7 +1172,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_footprint());
 }
 
 
@@ -730,8 +1182,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size;
-    char *p, *block;
+    int i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
@@ -751,6 +1203,15 @@ static void eval_mm_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case REALLOC: /* mm_realloc */
+            index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+            oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+                app_error("mm_realloc error in eval_mm_speed");
+            trace->blocks[index] = newp;
+            break;
+
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
@@ -762,6 +1223,680 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_traces - Check the mm malloc package for correctness, space
+ *    utilization and speed on every trace, filling in one stats_t per trace.
+ *    With -j the checks run in worker processes, and unless -J says
+ *    otherwise the timing is done here afterwards, one trace at a time
+ */
+static void eval_mm_traces(char **tracefiles, int num_tracefiles,
+                           stats_t *stats, range_t **ranges)
+{
+    int i;
+
+    if (jobs > 1)
+        eval_jobs(tracefiles, num_tracefiles, stats, 0);
+    if (jobs > 1 && jobs_timed)
+        return;
+    for (i=0; i < num_tracefiles; i++)
+        eval_mm_trace(tracefiles[i], i, &stats[i], ranges, jobs == 1, 1);
+}
+
+/*
+ * eval_mm_trace - Check the mm malloc package for correctness and space
+ *    utilization on one trace (if check is set), and time it (if timed is
+ *    set and the trace was run correctly)
+ */
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+                          range_t **ranges, int check, int timed)
+{
+    trace_t *trace;
+    speed_t speed_params;
+
+    trace = read_trace(tracedir, tracefile);
+    if (check) {
+        stats->ops = trace->num_ops;
+        if (verbose > 1)
+            printf("Checking mm_malloc for correctness, ");
+        stats->valid = eval_mm_valid(trace, tracenum, ranges);
+        if (stats->valid) {
+            if (verbose > 1)
+                printf("efficiency, ");
+            stats->util = eval_mm_util(trace, tracenum, ranges);
+        }
+    }
+    if (stats->valid && timed) {
+        speed_params.trace = trace;
+        speed_params.ranges = *ranges;
+        if (verbose > 1)
+            printf("and performance.\n");
+        stats->secs = fsecs(eval_mm_speed, &speed_params);
+    }
+    else if (check && verbose > 1)
+        printf("\n");
+    free_trace(trace);
+}
+
+/*
+ * eval_libc_traces - Check libc malloc for correctness and speed on every
+ *    trace, the same way eval_mm_traces does for the mm package
+ */
+static void eval_libc_traces(char **tracefiles, int num_tracefiles,
+                             stats_t *stats)
+{
+    int i;
+
+    if (jobs > 1)
+        eval_jobs(tracefiles, num_tracefiles, stats, 1);
+    if (jobs > 1 && jobs_timed)
+        return;
+    for (i=0; i < num_tracefiles; i++)
+        eval_libc_trace(tracefiles[i], i, &stats[i], jobs == 1, 1);
+}
+
+/*
+ * eval_libc_trace - Check libc malloc for correctness on one trace (if
+ *    check is set), and time it (if timed is set and the trace was run
+ *    correctly)
+ */
+static void eval_libc_trace(char *tracefile, int tracenum, stats_t *stats,
+                            int check, int timed)
+{
+    trace_t *trace;
+    speed_t speed_params;
+
+    trace = read_trace(tracedir, tracefile);
+    if (check) {
+        stats->ops = trace->num_ops;
+        if (verbose > 1)
+            printf("Checking libc malloc for correctness, ");
+        stats->valid = eval_libc_valid(trace, tracenum);
+    }
+    if (stats->valid && timed) {
+        speed_params.trace = trace;
+        if (verbose > 1)
+            printf("and performance.\n");
+        stats->secs = fsecs(eval_libc_speed, &speed_params);
+    }
+    else if (check && verbose > 1)
+        printf("\n");
+    free_trace(trace);
+}
+
+/*
+ * eval_jobs - Check the traces with libc malloc (if libc is set) or the
+ *    mm package in up to jobs worker processes at once, one per trace.
+ *    A worker is a fork of the driver, so it has a memlib heap and an mm
+ *    package all of its own, and it sends its stats_t back through a pipe.
+ *    With -J the workers time their traces as well, each pinned to a CPU
+ *    of its own, picked among the CPUs the driver may run on (so
+ *    "taskset -c" can point them at isolated CPUs). A worker that dies
+ *    leaves its trace marked as not valid.
+ */
+static void eval_jobs(char **tracefiles, int num_tracefiles, stats_t *stats,
+                      int libc)
+{
+    int fds[2];
+    int next = 0, running = 0, slot, status;
+    pid_t pid;
+    pid_t *slots;      /* the worker in each slot, or 0 */
+    int *slot_trace;   /* the trace it runs */
+    range_t *ranges = NULL;
+    job_result_t result;
+
+    if ((slots = (pid_t *)calloc(jobs, sizeof(pid_t))) == NULL ||
+        (slot_trace = (int *)calloc(jobs, sizeof(int))) == NULL)
+        unix_error("calloc failed in eval_jobs");
+    if (pipe(fds) < 0)
+        unix_error("pipe failed in eval_jobs");
+
+    while (next < num_tracefiles || running > 0) {
+        /* start a worker in a free slot... */
+        if (next < num_tracefiles && running < jobs) {
+            for (slot = 0; slots[slot] != 0; slot++)
+                ;
+            fflush(stdout); /* or the worker prints it again */
+            if ((pid = fork()) < 0)
+                unix_error("fork failed in eval_jobs");
+            if (pid == 0) {
+                close(fds[0]);
+                if (jobs_timed)
+                    pin_cpu(slot);
+                memset(&result, 0, sizeof(result));
+                result.tracenum = next;
+                errors = 0;
+                if (libc)
+                    eval_libc_trace(tracefiles[next], next, &result.stats, 1, jobs_timed);
+                else
+                    eval_mm_trace(tracefiles[next], next, &result.stats, &ranges, 1, jobs_timed);
+                result.errors = errors;
+                fflush(stdout);
+                /* less than PIPE_BUF bytes, so results never interleave */
+                if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+                    _exit(1);
+                _exit(0);
+            }
+            slots[slot] = pid;
+            slot_trace[slot] = next++;
+            running++;
+            continue;
+        }
+
+        /* ...or wait for one to finish. Every worker that exited cleanly
+         * has written its result, so there is one in the pipe to read,
+         * though not necessarily this worker's */
+        if ((pid = wait(&status)) < 0)
+            unix_error("wait failed in eval_jobs");
+        for (slot = 0; slot < jobs && slots[slot] != pid; slot++)
+            ;
+        if (slot == jobs)
+            continue;
+        slots[slot] = 0;
+        running--;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            if (read(fds[0], &result, sizeof(result)) != sizeof(result))
+                unix_error("read failed in eval_jobs");
+            stats[result.tracenum] = result.stats;
+            errors += result.errors;
+        }
+        else {
+            printf("ERROR [trace %d]: worker process died\n", slot_trace[slot]);
+            stats[slot_trace[slot]].valid = 0;
+            errors++;
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    free(slots);
+    free(slot_trace);
+}
+
+/*
+ * pin_cpu - Keep the calling process on one CPU, the slot-th of those
+ *    it may run on (wrapping around if there are fewer)
+ */
+static void pin_cpu(int slot)
+{
+#ifdef __linux__
+    cpu_set_t allowed, one;
+    int cpu, n = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return;
+    slot %= CPU_COUNT(&allowed);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &allowed) && n++ == slot)
+            break;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    sched_setaffinity(0, sizeof(one), &one);
+#endif
+}
+
+/*
+ * eval_mm_resident - Replay every trace on the mm package and print the
+ *    footprint (heap plus mapped regions) at RES_SAMPLES evenly spaced
+ *    points of the trace, plus its peak, in KB. Shows whether the package gives memory back
+ *    after a burst of requests instead of keeping its peak footprint.
+ */
+static void eval_mm_resident(char **tracefiles, int num_tracefiles)
+{
+    int i, j, sample;
+    trace_t *trace;
+
+    printf("Resident bytes (KB) over time:\n");
+    printf("%5s", "trace");
+    for (sample = 1; sample <= RES_SAMPLES; sample++)
+        printf("%6d%%", sample * 100 / RES_SAMPLES);
+    printf("%8s\n", "peak");
+
+    for (i = 0; i < num_tracefiles; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in eval_mm_resident");
+
+        printf("%5d", i);
+        sample = 1;
+        for (j = 0; j < trace->num_ops; j++) {
+            replay_op(trace, j, "eval_mm_resident");
+
+            /* Sample after the last op of every RES_SAMPLES-th of the trace */
+            while (sample <= RES_SAMPLES &&
+                   (long)(j + 1) * RES_SAMPLES >= (long)sample * trace->num_ops) {
+                printf("%7.0f", mem_footprint() / 1024.0);
+                sample++;
+            }
+        }
+        printf("%8.0f\n", mem_peak_footprint() / 1024.0);
+        free_trace(trace);
+    }
+    printf("\n");
+}
+
+/*
+ * eval_mm_stats - Replay every trace on the mm package and print its
+ *    counters at the point where the most bytes were live: the free
+ *    bytes and blocks, the largest free block and how much of the free
+ *    space lies outside of it (external fragmentation), and the free
+ *    slack at the end of the heap, in KB. The splits, coalesces, sbrk
+ *    calls and reallocs (in place or moved) are totals over the whole
+ *    trace.
+ *    With -V the free blocks of each size class are listed as well.
+ */
+static void eval_mm_stats(char **tracefiles, int num_tracefiles)
+{
+    int i, j, cls;
+    trace_t *trace;
+    mm_stats_t now, peak;
+
+    printf("Allocator counters at peak live bytes (KB):\n");
+    printf("%5s%9s%9s%8s%9s%7s%8s%8s%9s%10s%7s%8s%7s\n", "trace", "live", "free",
+           "blocks", "largest", "frag", "slack", "parked", "splits", "coalesces",
+           "sbrks", "inplace", "moved");
+
+    for (i = 0; i < num_tracefiles; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in eval_mm_stats");
+
+        memset(&peak, 0, sizeof(peak));
+        for (j = 0; j < trace->num_ops; j++) {
+            replay_op(trace, j, "eval_mm_stats");
+            mm_stats(&now);
+            if (now.live_bytes > peak.live_bytes)
+                peak = now;
+        }
+
+        printf("%5d%9.1f%9.1f%8zu%9.1f%6.1f%%%8.1f%8zu%9lu%10lu%7lu%8lu%7lu\n", i,
+               peak.live_bytes / 1024.0, peak.free_bytes / 1024.0,
+               peak.free_blocks, peak.largest_free / 1024.0,
+               peak.free_bytes ?
+               100.0 * (peak.free_bytes - peak.largest_free) / peak.free_bytes : 0.0,
+               peak.slack_bytes / 1024.0, peak.parked_blocks,
+               now.splits, now.coalesces, now.sbrks,
+               now.reallocs_in_place, now.reallocs_moved);
+        if (verbose > 1) {
+            printf("%5s", "");
+            for (cls = 0; cls < MM_NUM_CLASSES; cls++)
+                if (peak.class_blocks[cls])
+                    printf(" %d:%zu", cls, peak.class_blocks[cls]);
+            printf("\n");
+        }
+        free_trace(trace);
+    }
+    printf("\n");
+}
+
+/*
+ * eval_mm_perf - Replay every trace on the mm package under the CPU's
+ *    performance counters (perf_event_open, user mode only) and print
+ *    cycles, instructions, L1 data cache, last level cache and data TLB
+ *    misses per request, and the page faults per request of touching
+ *    new heap. A "-" marks an event that the CPU, the kernel or
+ *    perf_event_paranoid doesn't let us count (virtual machines often
+ *    have no hardware counters at all).
+ */
+static void eval_mm_perf(char **tracefiles, int num_tracefiles)
+{
+#ifdef __linux__
+    int i, j, e;
+    int fds[NUM_PERF_EVENTS];
+    long long count;
+    struct perf_event_attr attr;
+    trace_t *trace;
+
+    for (e = 0; e < NUM_PERF_EVENTS; e++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[e].type;
+        attr.config = perf_events[e].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = perf_events[e].type != PERF_TYPE_SOFTWARE;
+        attr.exclude_hv = 1;
+        fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    printf("Perf counters per request:\n");
+    printf("%5s", "trace");
+    for (e = 0; e < NUM_PERF_EVENTS; e++)
+        printf("%10s", perf_events[e].name);
+    printf("\n");
+
+    for (i = 0; i < num_tracefiles; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in eval_mm_perf");
+
+        for (e = 0; e < NUM_PERF_EVENTS; e++) {
+            if (fds[e] >= 0) {
+                ioctl(fds[e], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[e], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+        for (j = 0; j < trace->num_ops; j++)
+            replay_op(trace, j, "eval_mm_perf");
+        for (e = 0; e < NUM_PERF_EVENTS; e++)
+            if (fds[e] >= 0)
+                ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+
+        printf("%5d", i);
+        for (e = 0; e < NUM_PERF_EVENTS; e++) {
+            if (fds[e] >= 0 && read(fds[e], &count, sizeof(count)) == sizeof(count))
+                printf("%10.2f", (double)count / trace->num_ops);
+            else
+                printf("%10s", "-");
+        }
+        printf("\n");
+        free_trace(trace);
+    }
+    printf("\n");
+
+    for (e = 0; e < NUM_PERF_EVENTS; e++)
+        if (fds[e] >= 0)
+            close(fds[e]);
+#else
+    printf("Perf counters need Linux (perf_event_open)\n\n");
+#endif
+}
+
+/*
+ * eval_mm_latency - Time every request of each trace with the cycle
+ *     counter, and print the median, the tail percentiles and the
+ *     slowest request for each kind of request. The throughput numbers
+ *     average the occasional slow request (a long fit search, a heap
+ *     growth) away, this shows them. The cost of reading the counter
+ *     is measured once and taken off every sample
+ */
+static void eval_mm_latency(char **tracefiles, int num_tracefiles)
+{
+    int i, j, t;
+    unsigned long long start, cycles, overhead = ~0ULL;
+    lat_hist_t *hists;
+    trace_t *trace;
+
+    if ((hists = (lat_hist_t *)malloc(3 * sizeof(lat_hist_t))) == NULL)
+        unix_error("malloc failed in eval_mm_latency");
+
+    /* the cheapest of many back to back reads is the counter's own cost */
+    for (j = 0; j < 1000; j++) {
+        start = read_cycles();
+        cycles = read_cycles() - start;
+        overhead = cycles < overhead ? cycles : overhead;
+    }
+
+    printf("Latency per request in cycles (less %llu for reading the counter):\n", overhead);
+    printf("%5s%9s%10s%8s%8s%8s%10s%8s\n",
+           "trace", "request", "count", "p50", "p99", "p999", "max", "at op");
+    for (i = 0; i < num_tracefiles; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        memset(hists, 0, 3 * sizeof(lat_hist_t));
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in eval_mm_latency");
+
+        for (j = 0; j < trace->num_ops; j++) {
+            start = read_cycles();
+            replay_op(trace, j, "eval_mm_latency");
+            cycles = read_cycles() - start;
+            lat_record(&hists[trace->ops[j].type], cycles > overhead ? cycles - overhead : 0, j);
+        }
+
+        for (t = 0; t < 3; t++) {
+            if (hists[t].total == 0)
+                continue;
+            printf("%5d%9s%10lu%8llu%8llu%8llu%10llu%8d\n", i, op_names[t],
+                   hists[t].total, lat_percentile(&hists[t], 0.5),
+                   lat_percentile(&hists[t], 0.99), lat_percentile(&hists[t], 0.999),
+                   hists[t].max, hists[t].max_op);
+        }
+        free_trace(trace);
+    }
+    printf("\n");
+    free(hists);
+}
+
+/*
+ * read_cycles - The cycle counter as one number
+ */
+static unsigned long long read_cycles(void)
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/*
+ * lat_record - Count a request that took cycles in hist
+ */
+static void lat_record(lat_hist_t *hist, unsigned long long cycles, int opnum)
+{
+    int shift, bucket;
+
+    if (cycles < LAT_SUB)
+        bucket = cycles;
+    else {
+        /* the top LAT_SUB_BITS bits below the leading one pick the bucket */
+        shift = 63 - __builtin_clzll(cycles) - LAT_SUB_BITS;
+        bucket = (shift + 1) * LAT_SUB + (int)(cycles >> shift) - LAT_SUB;
+    }
+    hist->counts[bucket]++;
+    hist->total++;
+    if (cycles > hist->max || hist->total == 1) {
+        hist->max = cycles;
+        hist->max_op = opnum;
+    }
+}
+
+/*
+ * lat_percentile - The latency that a fraction p of the requests in hist
+ *     did not exceed, rounded up to the top of its bucket (but never
+ *     past the slowest request)
+ */
+static unsigned long long lat_percentile(lat_hist_t *hist, double p)
+{
+    unsigned long rank = (unsigned long)(p * hist->total + 0.999999);
+    unsigned long seen = 0;
+    unsigned long long top;
+    int bucket, shift;
+
+    for (bucket = 0; bucket < LAT_BUCKETS - 1; bucket++) {
+        if ((seen += hist->counts[bucket]) >= rank)
+            break;
+    }
+    if (bucket < LAT_SUB)
+        top = bucket;
+    else {
+        shift = bucket / LAT_SUB - 1;
+        top = ((unsigned long long)(bucket % LAT_SUB + LAT_SUB + 1) << shift) - 1;
+    }
+    return top < hist->max ? top : hist->max;
+}
+
+/*
+ * replay_op - Run request opnum of a trace on the mm package, for the
+ *    reports that don't check or time the package. caller names the
+ *    report in the error message if a request fails.
+ */
+static void replay_op(trace_t *trace, int opnum, char *caller)
+{
+    int index = trace->ops[opnum].index;
+    int size = trace->ops[opnum].size;
+    char *p;
+
+    switch (trace->ops[opnum].type) {
+    case ALLOC: /* mm_malloc */
+        if ((p = mm_malloc(size)) == NULL) {
+            sprintf(msg, "mm_malloc failed in %s", caller);
+            app_error(msg);
+        }
+        trace->blocks[index] = p;
+        break;
+    case REALLOC: /* mm_realloc */
+        if ((p = mm_realloc(trace->blocks[index], size)) == NULL) {
+            sprintf(msg, "mm_realloc failed in %s", caller);
+            app_error(msg);
+        }
+        trace->blocks[index] = p;
+        break;
+    case FREE: /* mm_free */
+        mm_free(trace->blocks[index]);
+        break;
+    default:
+        sprintf(msg, "Nonexistent request type in %s", caller);
+        app_error(msg);
+    }
+}
+
+#ifdef MM_THREADS
+/*
+ * eval_mm_threads - Run every trace in 1, 2, 4, ... up to max_threads
+ *    threads at once, all sharing the mm heap, and print the combined
+ *    throughput of each thread count. Each thread replays the whole
+ *    trace with blocks of its own. A "-" means the threads together
+ *    needed more than the heap holds.
+ */
+static void eval_mm_threads(char **tracefiles, int num_tracefiles,
+                            int max_threads)
+{
+    int i, j, n, failed;
+    trace_t *trace;
+    pthread_t tids[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    struct timeval start, end;
+    double secs;
+
+    printf("Multithreaded throughput (Kops):\n");
+    printf("%5s", "trace");
+    for (n = 1; n <= max_threads; n = NEXT_THREADS(n, max_threads))
+        printf("%8dt", n);
+    printf("\n");
+
+    for (i = 0; i < num_tracefiles; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        printf("%5d", i);
+        for (n = 1; n <= max_threads; n = NEXT_THREADS(n, max_threads)) {
+            mem_reset_brk();
+            if (mm_init() < 0)
+                app_error("mm_init failed in eval_mm_threads");
+
+            for (j = 0; j < n; j++) {
+                workers[j].trace = trace;
+                workers[j].failed = 0;
+                if ((workers[j].blocks = calloc(trace->num_ids, sizeof(char *))) == NULL)
+                    unix_error("blocks calloc in eval_mm_threads failed");
+            }
+            gettimeofday(&start, NULL);
+            for (j = 0; j < n; j++)
+                if (pthread_create(&tids[j], NULL, eval_mm_worker, &workers[j]) != 0)
+                    unix_error("pthread_create in eval_mm_threads failed");
+            failed = 0;
+            for (j = 0; j < n; j++) {
+                pthread_join(tids[j], NULL);
+                failed |= workers[j].failed;
+                free(workers[j].blocks);
+            }
+            gettimeofday(&end, NULL);
+
+            secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+            if (failed)
+                printf("%9s", "-");
+            else
+                printf("%9.0f", ((double)n * trace->num_ops / 1e3) / secs);
+        }
+        printf("\n");
+        free_trace(trace);
+    }
+    printf("\n");
+}
+
+/*
+ * eval_mm_worker - Body of one -T thread: replay its trace on mm,
+ *    stopping early if the heap runs out
+ */
+static void *eval_mm_worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    trace_t *trace = w->trace;
+    int i, index, size;
+    char *p;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(size)) == NULL) {
+                w->failed = 1;
+                return NULL;
+            }
+            w->blocks[index] = p;
+            break;
+        case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(w->blocks[index], size)) == NULL) {
+                w->failed = 1;
+                return NULL;
+            }
+            w->blocks[index] = p;
+            break;
+        case FREE: /* mm_free */
+            mm_free(w->blocks[index]);
+            break;
+        default:
+            app_error("Nonexistent request type in eval_mm_worker");
+        }
+    }
+    return NULL;
+}
+#endif
+
+/*
+ * eval_mm_compare - Run the traces once for every setting of the mm
+ *    parameter param (see mm_config) and print utilization and
+ *    throughput for each, so the setting can be chosen per workload.
+ *    names[i] describes setting i. The setting in effect before the
+ *    call is restored.
+ */
+static void eval_mm_compare(char *what, int param, char **names, int n,
+                            char **tracefiles, int num_tracefiles,
+                            range_t **ranges)
+{
+    int setting, i, old_setting;
+    double util, ops, secs;
+    stats_t *stats;
+
+    if ((stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t))) == NULL)
+        unix_error("stats calloc in eval_mm_compare failed");
+
+    printf("\nComparison by %s:\n", what);
+    printf("%10s%7s%10s\n", "setting", "util", "Kops");
+    old_setting = mm_config(param, 0);
+    for (setting = 0; setting < n; setting++) {
+        mm_config(param, setting);
+        memset(stats, 0, num_tracefiles * sizeof(stats_t));
+        eval_mm_traces(tracefiles, num_tracefiles, stats, ranges);
+        if (verbose) {
+            printf("\nResults for mm malloc, %s %s:\n", what, names[setting]);
+            printresults(num_tracefiles, stats);
+        }
+
+        util = ops = secs = 0;
+        for (i = 0; i < num_tracefiles; i++) {
+            util += stats[i].util;
+            ops += stats[i].ops;
+            secs += stats[i].secs;
+        }
+        printf("%10s%6.0f%%%10.0f\n", names[setting],
+               (util/num_tracefiles)*100.0, (ops/1e3)/secs);
+    }
+    printf("\n");
+    mm_config(param, old_setting);
+    free(stats);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -909,6 +2044,20 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * parse_fit - Map a placement policy name onto its MM_FIT_xxx value,
+ *    returns -1 for an unknown name
+ */
+static int parse_fit(char *name)
+{
+    int fit;
+
+    for (fit = 0; fit < MM_NUM_FITS; fit++)
+        if (!strcmp(name, fit_names[fit]))
+            return fit;
+    return -1;
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -941,14 +2090,33 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVgalPdDoOSrsCJL] [-f <file>] [-t <dir>] [-p <fit>] [-m <size>]\n");
+    fprintf(stderr, "               [-c <n>] [-w <n>] [-G <mask>] [-j <n>] [-T <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-p <fit>   Use placement policy first, next, best or bestN.\n");
+    fprintf(stderr, "\t-m <size>  Give requests of at least size bytes a mapped region (0 never).\n");
+    fprintf(stderr, "\t-P         Compare all placement policies.\n");
+    fprintf(stderr, "\t-c <n>     Check the heap every n requests (0 only after each trace).\n");
+    fprintf(stderr, "\t-w <n>     Walk only n blocks of the heap per check, in turn.\n");
+    fprintf(stderr, "\t-G <mask>  End the blocks of these size classes at a guard page (-1 all).\n");
+    fprintf(stderr, "\t-d         Use deferred coalescing.\n");
+    fprintf(stderr, "\t-D         Compare immediate and deferred coalescing.\n");
+    fprintf(stderr, "\t-o         Keep the free lists in address order.\n");
+    fprintf(stderr, "\t-O         Compare LIFO and address ordered free lists.\n");
+    fprintf(stderr, "\t-S         Reserve room after blocks that realloc grows.\n");
+    fprintf(stderr, "\t-r         Report the resident bytes over time.\n");
+    fprintf(stderr, "\t-s         Report the allocator counters for each trace.\n");
+    fprintf(stderr, "\t-C         Report cache misses per request (perf counters).\n");
+    fprintf(stderr, "\t-L         Report request latency percentiles (cycle counter).\n");
+    fprintf(stderr, "\t-j <n>     Check the traces in up to n worker processes at once.\n");
+    fprintf(stderr, "\t-J         Time the traces in the -j workers too, pinned to CPUs.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Run the traces in up to n threads (mdriver-mt only).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -2,7 +2,22 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            Besides the sbrk heap it hands out mapped regions, a model of
+ *            mmap/munmap for blocks that should not live in the heap. Their
+ *            bytes count towards the footprint of the package just like the
+ *            heap does. Each region is followed by a page that can't be
+ *            touched, so a package that writes past the end of a region
+ *            faults right there instead of corrupting its neighbor.
+ *
+ *            The heap is arena 0 of up to MAX_ARENAS independent arenas,
+ *            each with its own brk and room for MAX_HEAP bytes, so that
+ *            threads working in different arenas never share a brk. The
+ *            mem_sbrk family works on arena 0, the mem_arena_xxx family on
+ *            any arena. Built with -DMM_THREADS, all of it is guarded by one
+ *            lock. Moving a brk is rare enough for that not to matter.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +25,59 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 #include "memlib.h"
 #include "config.h"
 
+/* one arena, a heap of its own */
+typedef struct {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *max_addr;   /* largest legal heap address */ 
+    int guards;       /* guard areas set up with mem_guard and still there */
+} arena_t;
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static arena_t arenas[MAX_ARENAS];
+static int num_arenas;       /* arenas created so far, arena 0 by mem_init */
+static size_t mem_peak;      /* largest footprint since the last reset */
+
+#ifdef MM_THREADS
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK() pthread_mutex_lock(&mem_lock)
+#define UNLOCK() pthread_mutex_unlock(&mem_lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+/* mapped regions, in no particular order */
+#define MAX_REGIONS 1024
+static char *region_addr[MAX_REGIONS];
+static size_t region_size[MAX_REGIONS];
+static int num_regions;
+static size_t mem_mapped;    /* bytes in all mapped regions */
+
+static int find_region(void *addr);
+static int protect(void *addr, size_t size, int prot, int count);
+static void *map_pages(size_t size);
+static void note_footprint(void);
+static void unmap_all(void);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	   fprintf(stderr, "mem_init_vm: malloc error\n");
-	   exit(1);
-    }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    num_arenas = 0;
+    if (mem_init_arena(0) < 0)
+        exit(1);
+    mem_peak = 0;
+    num_regions = 0;
+    mem_mapped = 0;
 }
 
 /* 
@@ -39,57 +85,421 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    int i;
+
+    mem_reset_brk();
+    for (i = 0; i < num_arenas; i++)
+        free(arenas[i].start_brk);
+    num_arenas = 0;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make every
+ *    arena an empty heap, and unmap every region that is still mapped
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    int i;
+
+    LOCK();
+    for (i = 0; i < num_arenas; i++) {
+        arenas[i].brk = arenas[i].start_brk;
+        if (arenas[i].guards) {
+            mprotect(arenas[i].start_brk, MAX_HEAP, PROT_READ | PROT_WRITE);
+            arenas[i].guards = 0;
+        }
+    }
+    unmap_all();
+    mem_peak = 0;
+    UNLOCK();
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap by -incr bytes and returns the old
+ *    brk, like sbrk; the heap cannot shrink below its first byte.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_arena_sbrk(0, incr);
+}
+
+/*
+ * mem_init_arena - make sure that arenas 0 up to arena exist, each
+ *    with an empty heap. Returns 0 on success and -1 if arena is out
+ *    of range or there is no memory for it.
+ */
+int mem_init_arena(int arena)
+{
+    arena_t *a;
+
+    if (arena < 0 || arena >= MAX_ARENAS)
+        return -1;
+    LOCK();
+    while (num_arenas <= arena) {
+        a = &arenas[num_arenas];
+        /* allocate the storage we will use to model the available VM, page
+           aligned like a real heap so that any ALIGNMENT up to a page holds */
+        if (posix_memalign((void **)&a->start_brk, getpagesize(), MAX_HEAP) != 0) {
+	       fprintf(stderr, "mem_init_vm: malloc error\n");
+	       UNLOCK();
+	       return -1;
+        }
+        a->max_addr = a->start_brk + MAX_HEAP;  /* max legal heap address */
+        a->brk = a->start_brk;                  /* heap is empty initially */
+        /* publish the arena only once it is set up, see mem_arena_of */
+        __atomic_store_n(&num_arenas, num_arenas + 1, __ATOMIC_RELEASE);
+    }
+    UNLOCK();
+    return 0;
+}
+
+/*
+ * mem_arena_sbrk - mem_sbrk for the heap of the given arena, which
+ *    must have been created by mem_init_arena
+ */
+void *mem_arena_sbrk(int arena, int incr)
+{
+    arena_t *a = &arenas[arena];
+    char *old_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    /* the footprint adds up every brk, so they only move under the lock */
+    LOCK();
+    old_brk = a->brk;
+    if (incr < 0 && (a->brk - a->start_brk) < -(long)incr) {
+	   UNLOCK();
+	   errno = EINVAL;
+	   fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap start...\n");
+	   return (void *)-1;
+    }
+    /* the heaps share the MAX_HEAP budget with the mapped regions */
+    if ((a->brk + incr) > a->max_addr ||
+        (incr > 0 && mem_footprint() + incr > (size_t)MAX_HEAP * num_arenas)) {
+	   UNLOCK();
 	   errno = ENOMEM;
 	   fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	   return (void *)-1;
     }
-    mem_brk += incr;
+    a->brk += incr;
+    note_footprint();
+    UNLOCK();
     return (void *)old_brk;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_arena_lo - return address of the first heap byte of an arena
+ */
+void *mem_arena_lo(int arena)
+{
+    return (void *)arenas[arena].start_brk;
+}
+
+/*
+ * mem_arena_hi - return address of the last heap byte of an arena
+ */
+void *mem_arena_hi(int arena)
+{
+    return (void *)(arenas[arena].brk - 1);
+}
+
+/*
+ * mem_arena_of - return the arena whose heap could hold address p,
+ *    or -1 if p lies in none of them (it may be in a mapped region).
+ *    Needs no lock, an arena never moves once it exists.
+ */
+int mem_arena_of(void *p)
+{
+    int i, n = __atomic_load_n(&num_arenas, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n; i++)
+        if ((char *)p >= arenas[i].start_brk && (char *)p < arenas[i].max_addr)
+            return i;
+    return -1;
+}
+
+/*
+ * mem_guard - turn the whole pages at addr..addr+size-1, which must lie
+ *    in a heap, into a guard area that faults on any access, like a
+ *    PROT_NONE page of a real process. mem_unguard makes them
+ *    accessible again, and so does mem_reset_brk. Both return 0 on
+ *    success and -1 if the area is not page aligned or not in a heap.
+ */
+int mem_guard(void *addr, size_t size)
+{
+    return protect(addr, size, PROT_NONE, 1);
+}
+
+int mem_unguard(void *addr, size_t size)
+{
+    return protect(addr, size, PROT_READ | PROT_WRITE, -1);
+}
+
+/*
+ * protect - change the protection of a guard area, see mem_guard, and
+ *    count the area in or out of its arena's guards
+ */
+static int protect(void *addr, size_t size, int prot, int count)
+{
+    int i = mem_arena_of(addr);
+
+    if (i < 0 || ((size_t)addr | size) & (mem_pagesize() - 1) ||
+        (char *)addr + size > arenas[i].brk) {
+	   errno = EINVAL;
+	   fprintf(stderr, "ERROR: mem_guard failed. No heap pages at %p\n", addr);
+	   return -1;
+    }
+    if (mprotect(addr, size, prot) < 0) {
+	   fprintf(stderr, "ERROR: mem_guard failed. mprotect: %s\n", strerror(errno));
+	   return -1;
+    }
+    LOCK();
+    arenas[i].guards += count;
+    UNLOCK();
+    return 0;
+}
+
+/*
+ * mem_map - simple model of an anonymous mmap. Returns a new region of
+ *    size bytes, rounded up to whole pages, that starts on a page
+ *    boundary. The regions and the heaps together can't exceed MAX_HEAP
+ *    per arena. The page behind the region (not counted) is inaccessible.
+ */
+void *mem_map(size_t size)
+{
+    void *addr;
+
+    size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    LOCK();
+    if (num_regions == MAX_REGIONS ||
+        mem_footprint() + size > (size_t)MAX_HEAP * num_arenas) {
+	   UNLOCK();
+	   errno = ENOMEM;
+	   fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	   return NULL;
+    }
+    addr = map_pages(size);
+    if (addr == MAP_FAILED) {
+	   UNLOCK();
+	   fprintf(stderr, "ERROR: mem_map failed. mmap: %s\n", strerror(errno));
+	   return NULL;
+    }
+    region_addr[num_regions] = addr;
+    region_size[num_regions] = size;
+    num_regions++;
+    mem_mapped += size;
+    note_footprint();
+    UNLOCK();
+    return addr;
+}
+
+/*
+ * mem_unmap - unmap the region at addr, which must have been returned
+ *    by mem_map or mem_remap. size is the size it was mapped with.
+ *    Returns 0 on success and -1 if there is no such region.
+ */
+int mem_unmap(void *addr, size_t size)
+{
+    int i;
+
+    LOCK();
+    if ((i = find_region(addr)) < 0 ||
+        region_size[i] != ((size + mem_pagesize() - 1) & ~(mem_pagesize() - 1))) {
+	   UNLOCK();
+	   errno = EINVAL;
+	   fprintf(stderr, "ERROR: mem_unmap failed. No region of %zu bytes at %p\n",
+                   size, addr);
+	   return -1;
+    }
+    munmap(addr, region_size[i] + mem_pagesize());
+    mem_mapped -= region_size[i];
+    num_regions--;
+    region_addr[i] = region_addr[num_regions];
+    region_size[i] = region_size[num_regions];
+    UNLOCK();
+    return 0;
+}
+
+/*
+ * mem_remap - model of mremap. Resizes the region at addr, which was
+ *    mapped with old_size bytes, to new_size bytes (rounded up to
+ *    whole pages), keeping its contents. The region may move. Returns
+ *    its new address, or NULL (leaving the region alone) on failure.
+ */
+void *mem_remap(void *addr, size_t old_size, size_t new_size)
+{
+    int i;
+    void *new_addr;
+
+    new_size = (new_size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    LOCK();
+    if ((i = find_region(addr)) < 0 ||
+        region_size[i] != ((old_size + mem_pagesize() - 1) & ~(mem_pagesize() - 1))) {
+	   UNLOCK();
+	   errno = EINVAL;
+	   fprintf(stderr, "ERROR: mem_remap failed. No region of %zu bytes at %p\n",
+                   old_size, addr);
+	   return NULL;
+    }
+    if (new_size > region_size[i] &&
+        mem_footprint() + (new_size - region_size[i]) > (size_t)MAX_HEAP * num_arenas) {
+	   UNLOCK();
+	   errno = ENOMEM;
+	   fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+	   return NULL;
+    }
+#ifdef MREMAP_MAYMOVE
+    /* mremap wants one protection for the whole range, so the guard page
+       goes along as an ordinary page and is set up again at the new end */
+    mprotect(region_addr[i] + region_size[i], mem_pagesize(), PROT_READ | PROT_WRITE);
+    new_addr = mremap(addr, region_size[i] + mem_pagesize(),
+                      new_size + mem_pagesize(), MREMAP_MAYMOVE);
+    if (new_addr == MAP_FAILED) {
+	   mprotect(region_addr[i] + region_size[i], mem_pagesize(), PROT_NONE);
+	   UNLOCK();
+	   fprintf(stderr, "ERROR: mem_remap failed. mremap: %s\n", strerror(errno));
+	   return NULL;
+    }
+    mprotect((char *)new_addr + new_size, mem_pagesize(), PROT_NONE);
+#else
+    /* no mremap, so move the contents by hand */
+    new_addr = map_pages(new_size);
+    if (new_addr == MAP_FAILED) {
+	   UNLOCK();
+	   fprintf(stderr, "ERROR: mem_remap failed. mmap: %s\n", strerror(errno));
+	   return NULL;
+    }
+    memcpy(new_addr, addr, new_size < region_size[i] ? new_size : region_size[i]);
+    munmap(addr, region_size[i] + mem_pagesize());
+#endif
+    mem_mapped += new_size - region_size[i];
+    region_addr[i] = new_addr;
+    region_size[i] = new_size;
+    note_footprint();
+    UNLOCK();
+    return new_addr;
+}
+
+/*
+ * mem_is_mapped - return 1 if the bytes lo..hi all lie in one mapped
+ *    region, 0 otherwise
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    int i, found = 0;
+
+    LOCK();
+    for (i = 0; i < num_regions && !found; i++)
+        if ((char *)lo >= region_addr[i] &&
+            (char *)hi < region_addr[i] + region_size[i])
+            found = 1;
+    UNLOCK();
+    return found;
+}
+
+/*
+ * find_region - return the index of the region that starts at addr,
+ *    or -1 if there is none. Regions are few, so a linear scan will do.
+ */
+static int find_region(void *addr)
+{
+    int i;
+
+    for (i = 0; i < num_regions; i++)
+        if (region_addr[i] == (char *)addr)
+            return i;
+    return -1;
+}
+
+/*
+ * map_pages - mmap size bytes (whole pages) for a region, followed by
+ *    an inaccessible page. Returns MAP_FAILED if there is no room
+ */
+static void *map_pages(size_t size)
+{
+    char *addr = mmap(NULL, size + mem_pagesize(), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (addr != MAP_FAILED)
+        mprotect(addr + size, mem_pagesize(), PROT_NONE);
+    return addr;
+}
+
+/*
+ * unmap_all - unmap every region, with the lock held
+ */
+static void unmap_all(void)
+{
+    while (num_regions > 0) {
+        num_regions--;
+        munmap(region_addr[num_regions], region_size[num_regions] + mem_pagesize());
+    }
+    mem_mapped = 0;
+}
+
+/*
+ * note_footprint - update the peak footprint after the heap or the
+ *    regions grew, with the lock held
+ */
+static void note_footprint(void)
+{
+    if (mem_footprint() > mem_peak)
+        mem_peak = mem_footprint();
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte (of arena 0)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_arena_lo(0);
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last heap byte (of arena 0)
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_arena_hi(0);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, summed over all
+ *    arenas
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    int i;
+    size_t size = 0;
+
+    for (i = 0; i < num_arenas; i++)
+        size += (size_t)(arenas[i].brk - arenas[i].start_brk);
+    return size;
+}
+
+/*
+ * mem_mapsize() - returns the bytes in all mapped regions
+ */
+size_t mem_mapsize()
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_footprint() - returns the heap size plus the mapped bytes
+ */
+size_t mem_footprint()
+{
+    return mem_heapsize() + mem_mapped;
+}
+
+/*
+ * mem_peak_footprint() - returns the largest footprint in bytes since
+ *    the last mem_init or mem_reset_brk
+ */
+size_t mem_peak_footprint()
+{
+    return mem_peak;
 }
 
 /*
@@ -7,5 +7,27 @@ void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+
+/* independent heaps, arena 0 is the one the functions above work on */
+int mem_init_arena(int arena);
+void *mem_arena_sbrk(int arena, int incr);
+void *mem_arena_lo(int arena);
+void *mem_arena_hi(int arena);
+int mem_arena_of(void *p);
+
+/* guard areas inside a heap, see mem_guard */
+int mem_guard(void *addr, size_t size);
+int mem_unguard(void *addr, size_t size);
+
+/* mapped regions, outside the heap */
+void *mem_map(size_t size);
+int mem_unmap(void *addr, size_t size);
+void *mem_remap(void *addr, size_t old_size, size_t new_size);
+int mem_is_mapped(void *lo, void *hi);
+size_t mem_mapsize(void);
+
+/* heap plus mapped regions */
+size_t mem_footprint(void);
+size_t mem_peak_footprint(void);
 size_t mem_pagesize(void);
 
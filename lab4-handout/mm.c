@@ -3,29 +3,94 @@
  *
  * <Thien K. M. Bui buik@carleton.edu>
  *
- * Simple allocator based on implicit free lists, first fit search,
- * and boundary tag coalescing.
+ * Allocator based on segregated explicit free lists, first fit search
+ * within size classes, and boundary tag coalescing.
  *
- * Each block has header and footer of the form:
+ * Each block has a header of the form:
  *
- *      63                  4  3  2  1  0
- *      ------------------------------------
- *     | s  s  s  s  ... s  s  0  0  0  a/f |
- *      ------------------------------------
+ *      63                  4  3  2   1    0
+ *      ----------------------------------------
+ *     | s  s  s  s  ... s  s  m  q  pa  a/f |
+ *      ----------------------------------------
  *
- * where s are the meaningful size bits and a/f is 1
- * if and only if the block is allocated. The list has the following form:
+ * where s are the meaningful size bits, a/f is 1 if and only if the block
+ * is allocated, pa is 1 if and only if the block right before it in
+ * memory is allocated and q (bit 2) is 1 if and only if the block has been
+ * freed but is parked on a quick list (see MM_COALESCE_DEFERRED), in which
+ * case it still counts as allocated for everyone else. m (bit 3) marks a
+ * block that lives in a mapped region of its own instead of the heap (see
+ * below). Only free blocks carry a footer (a copy of the header), since the
+ * footer is only read when coalescing with a free block. Allocated blocks
+ * spend just one header of overhead and can use the space of their footer for
+ * payload. Headers are 64 bits wide by default, or 32 bits when built with
+ * -DMM_HDR_BITS=32, and block sizes are multiples of ALIGNMENT (16 unless
+ * config.h is told otherwise). Built with -DMM_LINK_BITS=32 as well, free
+ * blocks link to each other with 32-bit offsets instead of pointers and the
+ * smallest block shrinks from 32 to 16 bytes. The list has the following form:
  *
- * begin                                                             end
- * heap                                                             heap
- *  -----------------------------------------------------------------
- * |  pad   | hdr(16:a) | ftr(16:a) | zero or more usr blks | hdr(0:a) |
- *  -----------------------------------------------------------------
- *          |       prologue        |                       | epilogue |
- *          |         block         |                       | block    |
+ * begin                                                                        end
+ * heap                                                                        heap
+ *  ----------------------------------------------------------------------------
+ * | list heads  | hdr(A:a) | pad | ftr(A:a) | zero or more usr blks | hdr(0:a) |
+ *  ----------------------------------------------------------------------------
+ * | HEAD_WORDS  |         prologue         |                       | epilogue |
+ * |   words     |      block (ALIGNMENT)   |                       | block    |
  *
  * The allocated prologue and epilogue blocks are overhead that
  * eliminate edge conditions during coalescing.
+ *
+ * Free blocks smaller than TREE_MIN are kept in NUM_CLASSES doubly linked
+ * LIFO lists. Blocks smaller than SMALL_LIMIT get one class per exact size
+ * (32, 48, ..., 496), bigger ones one class per power of two up to TREE_MIN.
+ * Free blocks of at least TREE_MIN bytes are indexed by a splay tree keyed
+ * by size, so best fit among them costs O(log n) amortized no matter how
+ * many large holes the heap has. The list heads and the tree root live in
+ * the padding words in front of the prologue, so the allocator still needs
+ * no global arrays for its free blocks.
+ *
+ * Requests of at most SLAB_MAX bytes are served by a slab layer instead.
+ * Each tiny size class carves page-sized runs out of the end of the heap,
+ * packs its objects back to back with no per-object header and tracks
+ * free slots with a bitmap in the run header:
+ *
+ *  -----------------------------------------------------------------
+ * | hdr(RUN_BLOCK:a) | run_t | slot 0 | slot 1 | ... | slot n-1 |    |
+ *  -----------------------------------------------------------------
+ *                    ^ page aligned (relative to mem_heap_lo)
+ *
+ * The run is an ordinary allocated block as far as the rest of the heap is
+ * concerned. Since its payload starts on a page boundary, mm_free finds the
+ * run of any pointer by rounding down to the page and looking the page up in
+ * run_pages. A class only starts using runs after SLAB_WARMUP requests, so
+ * a handful of tiny requests does not cost a whole page.
+ *
+ * Requests of at least MM_MAP bytes skip the heap altogether. Each gets a
+ * region of whole pages from mem_map, with the block header right in front
+ * of the first aligned payload address:
+ *
+ *  -----------------------------------------------
+ * | pad | hdr(region size:m a) | payload ...       |
+ *  -----------------------------------------------
+ * ^ page aligned
+ *
+ * mm_free unmaps the region right away, so a huge block never leaves a hole
+ * in the heap, and mm_realloc resizes it with mem_remap instead of copying.
+ *
+ * For overflow hunting, mm_config(MM_GUARD) picks size classes whose blocks
+ * end at a guard page that faults on any access (see guard_malloc). Their
+ * payload sits behind a canary and is padded with fill bytes up to the page,
+ * and both are checked when the block is freed. This costs at least two pages
+ * per block, so it is meant for a few suspect classes at a time: guarding
+ * the tree class alone already runs random-bal.rep out of heap.
+ *
+ * Built with -DMM_THREADS (and -pthread), mm_malloc, mm_free and mm_realloc
+ * may be called from several threads at once. Everything above stays single
+ * threaded behind one heap lock. In front of it, each thread keeps a tcache:
+ * up to TCACHE_COUNT recently freed small blocks per size class, linked
+ * through their first payload word and still marked allocated in the heap.
+ * A thread only takes the lock when its tcache can't serve a request, or is
+ * full when it frees. mm_init and mm_config must not run concurrently with
+ * anything else.
  */
 
 #include <stdio.h>
@@ -35,14 +100,132 @@
 #include <string.h>
 #include <stdbool.h>
 
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
+
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
+
+/* Layout of the heap, picked at compile time (see the Makefile for the variants):
+ *  -DMM_HDR_BITS=64 or 32: width of block headers and footers. 32-bit headers
+ *      save four bytes on every block, but no block may reach 4 GB
+ *  -DALIGNMENT=n (config.h): payload alignment and granularity of block sizes,
+ *      a power of two of at least 16, since a header keeps four flag bits below
+ *      the size, and at most RUN_HDR
+ *  -DMM_LINK_BITS=64 or 32: width of the free list links. 32-bit links are
+ *      offsets from the heap start of the arena (see GET_LINK), which together
+ *      with 32-bit headers brings the smallest block down to 16 bytes
+ *  -DMM_DEFAULT_FIT=MM_FIT_xxx: placement policy (see below)
+ */
+#ifndef MM_HDR_BITS
+#define MM_HDR_BITS 64
+#endif
+#ifndef MM_LINK_BITS
+#define MM_LINK_BITS 64
+#endif
+
+#if MM_HDR_BITS == 64
+typedef size_t hdr_t;
+#elif MM_HDR_BITS == 32
+typedef unsigned int hdr_t;
+#else
+#error "MM_HDR_BITS must be 64 or 32"
+#endif
+
+#if MM_LINK_BITS != 64 && MM_LINK_BITS != 32
+#error "MM_LINK_BITS must be 64 or 32"
+#endif
 
 /* Basic constants and macros */
-#define WSIZE 8             /* word size (bytes) */
-#define DSIZE 16            /* doubleword size (bytes) */
-#define CHUNKSIZE (1 << 12) /* initial heap size (bytes) */
-#define OVERHEAD 16         /* overhead of header and footer (bytes) */
+#define HSIZE (MM_HDR_BITS / 8)       /* header and footer size (bytes) */
+#define LSIZE (MM_LINK_BITS / 8)      /* free list link size (bytes) */
+#define ALIGN ALIGNMENT               /* payload alignment, and block size granularity (bytes) */
+#define CHUNKSIZE (1 << 12)           /* initial heap size, and smallest growth step (bytes) */
+#define OVERHEAD ALIGN                /* size of the prologue: header, padding and footer (bytes) */
+#define ALLOC_OVERHEAD HSIZE          /* overhead of an allocated block, just its header (bytes) */
+#define MIN_BLOCK ROUND_UP(HSIZE + 2 * LSIZE + HSIZE) /* smallest legal block: hdr + 2 links + ftr (bytes) */
+#define MAX_BLOCK ((size_t)(hdr_t)~0xf) /* biggest size a header can hold (bytes) */
+
+/* Round n up to a multiple of the alignment */
+#define ROUND_UP(n) (((n) + ALIGN - 1) & ~(ALIGN - 1))
+
+/* A free block at the end of the heap of at least TRIM_THRESHOLD bytes is given
+ * back to memlib, all but its first TRIM_KEEP bytes (see MM_TRIM) */
+#define TRIM_THRESHOLD (1 << 16)
+#define TRIM_KEEP CHUNKSIZE
+
+/* Heap growth (see grow_heap): the step doubles while the heap keeps growing,
+ * up to GROW_MAX, and halves again for every GROW_IDLE requests without growth */
+#define GROW_MAX (1 << 15)  /* largest growth step, below TRIM_THRESHOLD (bytes) */
+#define GROW_BURST 32       /* most requests between two growths of a streak */
+#define GROW_STREAK 4       /* growths in a streak before the step starts doubling */
+#define GROW_IDLE 1024      /* requests without growth that halve the step */
+
+/* With MM_REALLOC_SLACK, a block that realloc grows gets room for this many
+ * more growths of the same size (but at most doubles) */
+#define SLACK_STEPS 4
+
+/* Requests of at least MAP_THRESHOLD bytes get a mapped region (see MM_MAP) */
+#define MAP_THRESHOLD (1 << 16)
+
+/* Per-thread caches: one bin per slab class, then one per exact list class */
+#define TCACHE_COUNT 8 /* blocks a thread keeps per bin */
+#define TCACHE_BINS (SLAB_CLASSES + SMALL_CLASSES)
+#define TCACHE_NEXT(bp) (*(void **)(bp)) /* full pointer, a bin mixes blocks of several arenas */
+
+/* The thread-safe build has one heap per memlib arena, each behind its own lock.
+ * LOCK_ARENA picks and locks one for a new block, LOCK_OWNER the one a block
+ * belongs to; either makes it the current arena, which UNLOCK releases */
+#ifdef MM_THREADS
+#define NUM_ARENAS MAX_ARENAS
+#define THREAD_LOCAL __thread
+#define LOCK_ARENA() (lock_arena() != NULL)
+#define LOCK_OWNER(bp) (lock_owner(bp))
+#define UNLOCK() (pthread_mutex_unlock(&arena->lock))
+#else
+#define NUM_ARENAS 1
+#define THREAD_LOCAL
+#define LOCK_ARENA() (true)
+#define LOCK_OWNER(bp)
+#define UNLOCK()
+#endif
+
+/* Segregated free list size classes */
+#define SMALL_LIMIT 512                               /* first power-of-two class (bytes) */
+#define SMALL_SHIFT 9                                 /* log2(SMALL_LIMIT) */
+#define SMALL_CLASSES ((SMALL_LIMIT - MIN_BLOCK) / ALIGN) /* exact-size classes below SMALL_LIMIT */
+#define TREE_MIN 1024                                 /* free blocks this big go in the tree (bytes) */
+#define TREE_SHIFT 10                                 /* log2(TREE_MIN) */
+#define NUM_CLASSES (SMALL_CLASSES + TREE_SHIFT - SMALL_SHIFT)
+#define TREE_ROOT NUM_CLASSES                         /* head word holding the tree root */
+
+/* Slab classes for tiny requests */
+#define SLAB_MAX 64                          /* largest request served by a slab (bytes) */
+#define SLAB_CLASSES (SLAB_MAX / ALIGN)      /* one class per multiple of the alignment */
+#define SLAB_WARMUP 64                       /* requests before a class gets runs */
+#define RUN_PAGE (1 << 12)                   /* run payload size and alignment (bytes) */
+#define RUN_BLOCK (RUN_PAGE + ALIGN)         /* size of the block holding a run (bytes) */
+#define RUN_HDR 64                           /* sizeof(run_t) rounded up to a slot boundary */
+
+/* Quick lists for deferred coalescing, one per list class plus one for tree sizes */
+#define QUICK_LISTS (NUM_CLASSES + 1)
+#define QUICK_LIMIT 256 /* parked blocks that trigger a batch coalesce */
+#define QUICK_SCAN 8    /* blocks checked for an exact fit on a quick list */
+
+/* Hint index for address ordered lists (MM_ORDER_ADDRESS): the heap is cut into
+ * regions, and each list class remembers its first block in every region */
+#define HINT_SHIFT 16                                  /* log2 of the region size */
+#define HINT_REGIONS (MAX_HEAP >> HINT_SHIFT)          /* regions of an arena's heap */
+#define HINT_WORDS ((HINT_REGIONS + 63) / 64)          /* words of the region bitmaps */
+#define HINT_REGION(bp) ((size_t)((char *)(bp) - (char *)mem_arena_lo(arena->id)) >> HINT_SHIFT)
+
+/* Words in front of the prologue: list heads, tree root, slab run lists and quick lists.
+ * HEAD_SPACE is the room they take together with the prologue header, rounded
+ * up so that the payload of the prologue (the heap start) is aligned */
+#define HEAD_WORDS (NUM_CLASSES + 1 + SLAB_CLASSES + QUICK_LISTS)
+#define HEAD_SPACE ROUND_UP(HEAD_WORDS * sizeof(void *) + HSIZE)
 
 /* NOTE: feel free to replace these macros with helper functions and/or
  * add new ones that will be useful for you. Just make sure you think
@@ -52,148 +235,575 @@
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size) | (alloc))
 
-/* Read and write a word at address p */
-#define GET(p) (*(size_t *)(p))
-#define PUT(p, val) (*(size_t *)(p) = (val))
+/* Read and write a header or footer at address p */
+#define GET(p) (*(hdr_t *)(p))
+#define PUT(p, val) (*(hdr_t *)(p) = (hdr_t)(val))
 
 /* Perform unscaled pointer arithmetic */
 #define PADD(p, val) ((char *)(p) + (val))
 #define PSUB(p, val) ((char *)(p) - (val))
 
 /* Read the size and allocated fields from address p */
-#define GET_SIZE(p) (GET(p) & ~0xf)
+#define GET_SIZE(p) ((size_t)(GET(p) & ~0xf))
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
-/* Given block ptr bp, compute address of its header and footer */
-#define HDRP(bp) (PSUB(bp, WSIZE))
-#define FTRP(bp) (PADD(bp, GET_SIZE(HDRP(bp)) - DSIZE))
+/* The prev-allocated bit of a header: set when the previous block is allocated */
+#define PREV_ALLOC 0x2
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+
+/* Given block ptr bp, set or clear the prev-allocated bit in its header */
+#define SET_PREV_ALLOC(bp) (PUT(HDRP(bp), GET(HDRP(bp)) | PREV_ALLOC))
+#define CLR_PREV_ALLOC(bp) (PUT(HDRP(bp), GET(HDRP(bp)) & ~(hdr_t)PREV_ALLOC))
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* The quick bit of a header: set while a freed block waits on a quick list */
+#define QUICK 0x4
+#define GET_QUICK_BIT(p) (GET(p) & QUICK)
+
+/* The mapped bit of a header: set when the block has a region to itself */
+#define MAPPED 0x8
+#define GET_MAPPED(p) (GET(p) & MAPPED)
+
+/* Given the payload of a mapped block, the start of its region */
+#define REGIONP(bp) (PSUB(bp, ALIGN))
+
+/* Given block ptr bp, compute address of its header and footer
+ * NOTE: only free blocks have a footer */
+#define HDRP(bp) (PSUB(bp, HSIZE))
+#define FTRP(bp) (PADD(bp, GET_SIZE(HDRP(bp)) - 2 * HSIZE))
+
+/* Given block ptr bp, compute address of next and previous blocks
+ * NOTE: PREV_BLKP reads the footer of the previous block, so it may only be
+ *      used when the prev-allocated bit of bp is clear */
 #define NEXT_BLKP(bp) (PADD(bp, GET_SIZE(HDRP(bp))))
-#define PREV_BLKP(bp) (PSUB(bp, GET_SIZE((PSUB(bp, DSIZE)))))
+#define PREV_BLKP(bp) (PSUB(bp, GET_SIZE((PSUB(bp, 2 * HSIZE)))))
+
+/* We'll need a way to GET and SET the bytes in the padding before the prologue.
+    We'll store the heads of the segregated explicit free lists here, class 0
+    at the lowest address, followed by the root of the tree (TREE_ROOT) */
+
+#define HEAD_ADDR(i) (PADD(arena->heap_start, sizeof(void *) * (i) - HEAD_SPACE))
+#define GET_HEAD(i) (*(void **)HEAD_ADDR(i))
+#define SET_HEAD(i, bp) (*(void **)HEAD_ADDR(i) = (void *)(bp))
+
+/* The slab classes keep their list of runs with free slots in the words
+    right after the free list heads */
+#define GET_RUNS(c) ((run_t *)GET_HEAD(TREE_ROOT + 1 + (c)))
+#define SET_RUNS(c, run) (SET_HEAD(TREE_ROOT + 1 + (c), run))
+
+/* The quick lists come after those, indexed by the size_class of their blocks */
+#define GET_QUICK(i) (GET_HEAD(TREE_ROOT + 1 + SLAB_CLASSES + (i)))
+#define SET_QUICK(i, bp) (SET_HEAD(TREE_ROOT + 1 + SLAB_CLASSES + (i), bp))
 
-/* We'll a way to GET and SET the bytes in the padding before the prologue
-    We'll store the pointer to the head of our explicit free list here*/
+/* Slab class of a tiny request and the object size of a slab class */
+#define SLAB_CLASS(size) (((size) - 1) / ALIGN)
+#define SLAB_SIZE(c) (((c) + 1) * ALIGN)
 
-#define GET_START ((void *)GET(PSUB(heap_start, DSIZE)))
-#define SET_START(bp) (PUT(PSUB(heap_start, DSIZE), (size_t)bp))
+/* Index of the page that address p falls in, relative to the heap start */
+#define PAGE_INDEX(p) ((size_t)((char *)(p) - (char *)mem_arena_lo(arena->id)) / RUN_PAGE)
 
 /* We'll also need macros to get/set the NXT and PREV chunks of a free list node
     These are use to read/write into the payload of a free block, which will store
-    the previous and next pointers in the first 16 bytes of the payload
+    the previous and next pointers in the first 2 * LSIZE bytes of the payload
 
     free blocks would look like this
     * begin                                                             end
     * heap                                                             heap
     *  -----------------------------------------------------------------
-    * | hdr(16n:f) | |prev addr| | nxt addr |                    ftr(16n:f)
+    * | hdr(An:f) | |prev addr| | nxt addr |                    ftr(An:f)
     *  -----------------------------------------------------------------
-    *                | 8 bytes | | 8 bytes  |
+    *               | LSIZE   | | LSIZE    |
 */
-#define GET_NXT_PTR(p) ((void *)GET(PADD(p, WSIZE)))
-#define GET_PREV_PTR(p) ((void *)GET(p))
-
-#define SET_NXT_PTR(bp, ptr) (PUT(PADD(bp, WSIZE), (size_t)ptr))
-#define SET_PREV_PTR(bp, ptr) (PUT(bp, (size_t)ptr))
+#if MM_LINK_BITS == 64
+#define GET_LINK(p) (*(void **)(p))
+#define SET_LINK(p, ptr) (*(void **)(p) = (void *)(ptr))
+#else
+/* Compressed links hold the distance from the heap start of the current arena,
+    which no block starts at, so 0 stands for NULL. A list never leaves its arena,
+    but anything else chaining blocks (the tcache) has to use full pointers */
+#define GET_LINK(p) (link_to_ptr(*(unsigned int *)(p)))
+#define SET_LINK(p, ptr) (*(unsigned int *)(p) = ptr_to_link(ptr))
+#endif
+
+#define GET_NXT_PTR(p) (GET_LINK(PADD(p, LSIZE)))
+#define GET_PREV_PTR(p) (GET_LINK(p))
+
+#define SET_NXT_PTR(bp, ptr) (SET_LINK(PADD(bp, LSIZE), ptr))
+#define SET_PREV_PTR(bp, ptr) (SET_LINK(bp, ptr))
+
+/* Free blocks in the tree (at least TREE_MIN bytes) have two more links after
+    prev and nxt, for the left and right children. The tree holds one block per
+    distinct size, blocks of the same size hang off it in a list through nxt.
+
+    * | hdr(An:f) | |prev addr| | nxt addr | |left addr| |right addr|     ftr(An:f)
+    *               | LSIZE   | | LSIZE    | | LSIZE   | | LSIZE    |
+
+    The tree node itself has a NULL prev, every other block in the list has a
+    non-NULL one, which is how efl_remove tells them apart.
+*/
+#define GET_LEFT(bp) (GET_LINK(PADD(bp, 2 * LSIZE)))
+#define GET_RIGHT(bp) (GET_LINK(PADD(bp, 3 * LSIZE)))
+
+#define SET_LEFT(bp, ptr) (SET_LINK(PADD(bp, 2 * LSIZE), ptr))
+#define SET_RIGHT(bp, ptr) (SET_LINK(PADD(bp, 3 * LSIZE), ptr))
+
+/* A search that chases links reads the header of every block it reaches, and
+    the header shares a cache line with the links in front of which it sits (or
+    ends the line before). Walks ask for the next block (or both children) with
+    PREFETCH as soon as they know it, so that its miss overlaps with the work on
+    the current one instead of following it. Build with -DMM_NO_PREFETCH to
+    compare. NOTE: bp may be NULL at the end of a list or tree, which is skipped:
+    the prefetch couldn't fault, but its header address wouldn't be a pointer */
+#ifdef MM_NO_PREFETCH
+#define PREFETCH(bp)
+#else
+#define PREFETCH(bp)                          \
+    do                                        \
+    {                                         \
+        void *pf_bp = (bp);                   \
+        if (pf_bp)                            \
+            __builtin_prefetch(HDRP(pf_bp));  \
+    } while (0)
+#endif
+
+/* Guard blocks, see guard_malloc. The payload is preceded by the request size
+    and a canary word, and followed by GUARD_FILL bytes up to the guard page */
+#define GUARD_FRONT ROUND_UP(2 * sizeof(size_t))      /* bytes in front of the payload */
+#define GUARD_PAGE RUN_PAGE                           /* size of the guard area (bytes) */
+#define GUARD_CANARY ((size_t)0x5ca1ab1edeadbeefULL)  /* xored with the payload address */
+#define GUARD_FILL 0xa5                               /* fill between the payload and the guard */
+#define GUARD_BLOCK(size) (GUARD_FRONT + ROUND_UP(size) + GUARD_PAGE + ALIGN) /* block size */
+#define GUARDED(asize) (guard_mask & (1L << size_class(asize)))
+
+/* Default placement policy, override with -DMM_DEFAULT_FIT=MM_FIT_xxx or at
+ * runtime through mm_config */
+#ifndef MM_DEFAULT_FIT
+#define MM_DEFAULT_FIT MM_FIT_FIRST
+#endif
+#define DEFAULT_FIT_DEPTH 8 /* candidates examined by MM_FIT_BEST_OF_N */
+
+/* Header of a slab run, stored at the start of the run's page
+    A set bit in free_map means the slot is free */
+typedef struct run_t
+{
+    struct run_t *prev; /* runs of the same class with free slots */
+    struct run_t *next;
+    unsigned int cls;   /* slab class */
+    unsigned int nfree; /* number of free slots */
+    unsigned long free_map[((RUN_PAGE - RUN_HDR) / ALIGN + 63) / 64];
+} run_t;
+
+_Static_assert(sizeof(run_t) <= RUN_HDR, "run_t must fit in front of the first slot");
+_Static_assert(ALIGNMENT >= 16 && ALIGNMENT <= RUN_HDR && (ALIGNMENT & (ALIGNMENT - 1)) == 0,
+               "ALIGNMENT must be a power of two between 16 and RUN_HDR");
+_Static_assert(NUM_CLASSES + 1 <= MM_NUM_CLASSES, "mm.h must count the list classes and the tree");
+_Static_assert(MM_LINK_BITS == 64 || MAX_HEAP <= 0xffffffffL, "32-bit links can't span the heap");
+
+/* One heap and everything that belongs to it. Every routine below works on
+    the current arena of the calling thread */
+typedef struct
+{
+    int id;                        /* memlib arena of the heap, and index in arenas */
+    bool ready;                    /* the heap has been set up since mm_init */
+    void *heap_start;              /* payload of the prologue block */
+    void *rover;                   /* where the next MM_FIT_NEXT search resumes, NULL
+                                      means the head of the class */
+    int quick_count;               /* blocks parked on the quick lists */
+    size_t grow_step;              /* bytes the heap grows by when nothing fits */
+    unsigned long requests;        /* heap_malloc calls so far */
+    unsigned long last_growth;     /* value of requests when the heap last grew */
+    int growths;                   /* growths in the current streak */
+    int slab_seen[SLAB_CLASSES];   /* tiny requests seen per slab class, counts up
+                                      to SLAB_WARMUP */
+    unsigned char run_pages[MAX_HEAP / RUN_PAGE]; /* for every page of the heap, 1 + the
+                                      slab class of the run whose payload starts there,
+                                      or 0 if no run starts in that page */
+    size_t run_pages_used;         /* entries of run_pages that may be nonzero */
+    unsigned short guard_at[MAX_HEAP / RUN_PAGE]; /* for every page of the heap, 1 + the
+                                      offset in the page (in ALIGN units) of the guarded
+                                      payload that starts there, or 0 */
+    long guarded;                  /* guarded blocks handed out and not freed yet */
+    mm_stats_t stats;              /* counters for mm_stats, kept since the heap was set up */
+    void *hints[NUM_CLASSES][HINT_REGIONS];          /* address order only: the first block
+                                      of each list class in every region, or NULL */
+    unsigned long hint_map[NUM_CLASSES][HINT_WORDS]; /* bit set for every non-NULL hint */
+    long check_ops;                /* requests since the last sampled check */
+    void *check_cursor;            /* where the next check_heap_window walk starts, NULL
+                                      means the first block */
+#ifdef MM_THREADS
+    pthread_mutex_t lock;          /* guards all of the above and the heap itself */
+#endif
+} arena_t;
 
 /* Global variables */
 
-// Pointer to first block
-static void *heap_start = NULL;
+static arena_t arenas[NUM_ARENAS];
+
+// The arena the calling thread is working on
+static THREAD_LOCAL arena_t *arena = &arenas[0];
+
+// Placement policy used by find_fit and its parameters
+static int fit_policy = MM_DEFAULT_FIT;
+static long fit_depth = DEFAULT_FIT_DEPTH;
+
+// Whether tiny requests go to the slab layer at all
+static bool slab_enabled = true;
+
+// Whether mm_free coalesces right away or parks blocks on the quick lists
+static int coalesce_mode = MM_COALESCE_IMMEDIATE;
+
+// Whether realloc reserves room after a block that grows
+static bool realloc_slack = false;
+
+// Whether the list classes are LIFO or sorted by address (the tree is sorted by size)
+static int list_order = MM_ORDER_LIFO;
+
+// Size from which a free block at the end of the heap is trimmed, 0 never trims
+static size_t trim_threshold = TRIM_THRESHOLD;
+
+// Request size from which a block gets a mapped region, 0 never maps
+static size_t map_threshold = MAP_THRESHOLD;
+
+// Size classes (bit i for class i) whose blocks end at a guard page, see guard_malloc
+static long guard_mask = 0;
+
+// Requests between two heap checks (0 never checks), and the number of blocks
+// each check walks (0 walks the whole heap)
+static long check_every = 0;
+static long check_window = 0;
+
+#ifdef MM_THREADS
+// The arena a thread allocates from, NULL until its first cache miss
+static __thread arena_t *home = NULL;
+
+// Round robin counter that hands out home arenas
+static unsigned int next_home = 0;
+
+// Set once the arena locks have been initialized
+static bool locks_ready = false;
+
+// Bumped by mm_init. A tcache filled under an older heap is stale, and is
+// emptied (without freeing anything) the next time its thread uses it
+static unsigned long heap_generation = 1;
+
+// A thread's cache of freed blocks, see tcache_get and tcache_put
+typedef struct
+{
+    void *bins[TCACHE_BINS];              /* singly linked through the first payload word */
+    unsigned char counts[TCACHE_BINS];    /* blocks in each bin */
+    unsigned long generation;             /* heap_generation the bins belong to */
+    bool registered;                      /* thread exit will flush the bins */
+} tcache_t;
+
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+#endif
 
 /* Function prototypes for internal helper routines */
 
 static bool check_heap(int lineno);
+static bool check_heap_window(int lineno);
+static void check_sample(void);
 static void print_heap();
 static void print_block(void *bp);
 static bool check_block(int lineno, void *bp);
+static bool check_lists(int lineno);
+static bool check_node(int lineno, void *node, size_t lo, size_t hi, long *left, size_t *bytes);
+static bool check_free(int lineno, void *bp, int cls);
+static bool on_list(void *bp);
 static void *extend_heap(size_t size);
+static void *grow_heap(size_t asize);
 static void *find_fit(size_t asize);
+static void *search_class(int cls, size_t asize);
 static void *coalesce(void *bp);
 static void place(void *bp, size_t asize);
+static void trim_block(void *bp, size_t asize);
+static void trim_heap(void *bp);
+static size_t adjust_size(size_t size);
 static size_t max(size_t x, size_t y);
+static int size_class(size_t size);
+#if MM_LINK_BITS == 32
+static void *link_to_ptr(unsigned int link);
+static unsigned int ptr_to_link(void *bp);
+#endif
+
+// size-ordered splay tree for the large free blocks
+static void *splay(void *t, size_t size);
+static void tree_insert(void *bp);
+static void tree_remove(void *bp);
+static void *tree_fit(size_t asize);
 
 // functions not provided by assignment
 static void efl_push(void *bp);
 static void efl_remove(void *bp);
+static void efl_insert(void *bp, int cls);
+static long hint_after(int cls, size_t region);
+static long hint_before(int cls, size_t region);
+static void sort_lists(void);
+static void free_block(void *bp);
+
+// the single threaded allocator behind mm_malloc, mm_free and mm_realloc
+static void *heap_malloc(size_t size);
+static void heap_free(void *bp);
+static void *heap_realloc(void *ptr, size_t size);
+
+// quick lists for deferred coalescing
+static void *quick_fit(size_t asize);
+static void quick_flush(void);
+
+// slab layer for tiny requests
+static void *slab_malloc(size_t size);
+static void slab_free(run_t *run, void *ptr);
+static run_t *slab_run_of(void *ptr);
+static run_t *carve_run(int cls);
+
+// blocks in mapped regions of their own
+static void *map_block(size_t size);
+static void *remap_block(void *bp, size_t size);
+
+// guard blocks for overflow hunting
+static void *guard_malloc(size_t size);
+static void guard_free(void *ptr);
+static bool is_guarded(void *ptr);
+static bool guard_intact(void *ptr);
+
+static int arena_init(void);
+
+#ifdef MM_THREADS
+// arena selection
+static arena_t *lock_arena(void);
+static arena_t *lock_owner(void *bp);
+
+// per-thread caches
+static int tcache_bin(size_t size);
+static void *tcache_get(size_t size);
+static bool tcache_put(void *bp);
+static void tcache_flush(void *unused);
+static void tcache_key_init(void);
+#endif
 
 /*
  * mm_init
-    Initialize an empty heap by setting up the prologue and epilogue blocks.
-    Sets start to an empty value
+ * Start over with empty heaps
+ * @param: none
+ * @return: 0 on success, -1 if the first heap could not be set up
+ * NOTE: only arena 0 gets its heap right away, the others (thread-safe build
+ *      only) are set up when a thread first picks them
+ */
+int mm_init(void)
+{
+    int i;
+
+    for (i = 0; i < NUM_ARENAS; i++)
+    {
+        arenas[i].id = i;
+        arenas[i].ready = false;
+    }
+#ifdef MM_THREADS
+    if (!locks_ready)
+    {
+        for (i = 0; i < NUM_ARENAS; i++)
+            pthread_mutex_init(&arenas[i].lock, NULL);
+        locks_ready = true;
+    }
+    heap_generation++;
+    // the calling thread keeps arena 0, other threads are spread over the rest
+    home = &arenas[0];
+    next_home = 1;
+#endif
+    arena = &arenas[0];
+    return arena_init();
+}
+
+/*
+ * arena_init
+    Initialize an empty heap in the current arena by setting up the prologue and
+    epilogue blocks.
     After running the function the heap looks like this
 
-    *  -----------------------------------------------------------------
-    * |  pad   | hdr(16:a) | ftr(16:a) | zero or more usr blks | hdr(0:a) |
-    *  -----------------------------------------------------------------
-    *          |       prologue        |                       | epilogue |
-    *          |         block         |                       | block    |
+    *  ----------------------------------------------------------------------
+    * | class heads | hdr(16:a) | ftr(16:a) | zero or more usr blks | hdr(0:a) |
+    *  ----------------------------------------------------------------------
+    *               |       prologue        |                       | epilogue |
+    *               |         block         |                       | block    |
     *
     NOTE: does not take in an argument
-    NOTE: if for some reason C can't "extend" the heap by 32 bytes at the start,
-    the function will return -1 and the traces should terminate
+    NOTE: if for some reason C can't "extend" the heap by the size of the class
+    heads plus the prologue/epilogue at the start, the function will return -1
+    and the traces should terminate
  */
-int mm_init(void)
+static int arena_init(void)
 {
-    /* create the initial empty heap */
-    if ((heap_start = mem_sbrk(4 * WSIZE)) == NULL)
-        return -1;
+    int i;
 
-    PUT(heap_start, 0);                               /* alignment padding */
-    PUT(PADD(heap_start, WSIZE), PACK(OVERHEAD, 1));  /* prologue header */
-    PUT(PADD(heap_start, DSIZE), PACK(OVERHEAD, 1));  /* prologue footer */
-    PUT(PADD(heap_start, WSIZE + DSIZE), PACK(0, 1)); /* epilogue header */
+    /* the memlib arena may not exist yet */
+    if (mem_init_arena(arena->id) < 0)
+        return -1;
 
-    heap_start = PADD(heap_start, DSIZE); /* start the heap at the (size 0) payload of the prologue block */
+    /* forget the runs of the previous heap */
+    memset(arena->run_pages, 0, arena->run_pages_used);
+    arena->run_pages_used = 0;
+    if (arena->guarded)
+        memset(arena->guard_at, 0, sizeof(arena->guard_at));
+    arena->guarded = 0;
 
-    // make the start of efl NULL
-    SET_START(NULL);
+    /* create the initial empty heap */
+    memset(&arena->stats, 0, sizeof(arena->stats));
+    if ((long)(arena->heap_start = mem_arena_sbrk(arena->id, HEAD_SPACE + OVERHEAD)) < 0)
+        return -1;
+    arena->stats.sbrks++;
+
+    arena->heap_start = PADD(arena->heap_start, HEAD_SPACE); /* start the heap at the (empty) payload of the prologue block */
+
+    PUT(HDRP(arena->heap_start), PACK(OVERHEAD, 1));                  /* prologue header */
+    PUT(FTRP(arena->heap_start), PACK(OVERHEAD, 1));                  /* prologue footer */
+    PUT(HDRP(NEXT_BLKP(arena->heap_start)), PACK(0, PREV_ALLOC | 1)); /* epilogue header */
+
+    // every size class and every slab class starts out empty
+    for (i = 0; i < HEAD_WORDS; i++)
+        SET_HEAD(i, NULL);
+    for (i = 0; i < SLAB_CLASSES; i++)
+        arena->slab_seen[i] = 0;
+    arena->rover = NULL;
+    arena->quick_count = 0;
+    arena->grow_step = CHUNKSIZE;
+    arena->requests = 0;
+    arena->last_growth = 0;
+    arena->growths = 0;
+    arena->check_ops = 0;
+    arena->check_cursor = NULL;
+    memset(arena->hints, 0, sizeof(arena->hints));
+    memset(arena->hint_map, 0, sizeof(arena->hint_map));
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
+    if (extend_heap(CHUNKSIZE) == NULL)
         return -1;
 
+    arena->ready = true;
     return 0;
 }
 
 /*
  * mm_malloc
+ * Allocate size bytes, from the tcache of the calling thread if it can
+ * @param: request size in bytes
+ * @return: pointer to the payload, or NULL if size is 0 or the heap is exhausted
+ */
+void *mm_malloc(size_t size)
+{
+    void *bp;
+
+#ifdef MM_THREADS
+    if ((bp = tcache_get(size)) != NULL)
+        return bp;
+#endif
+    if (!LOCK_ARENA())
+        return NULL;
+    bp = heap_malloc(size);
+    if (check_every)
+        check_sample();
+    UNLOCK();
+    return bp;
+}
+
+/*
+ * mm_free
+ * Free the block at bp, into the tcache of the calling thread if it has room
+ * @param: pointer to a payload handed out by mm_malloc or mm_realloc
+ * @return: nothing
+ */
+void mm_free(void *bp)
+{
+    // the block goes back to the arena it came from, whichever thread frees it
+    LOCK_OWNER(bp);
+#ifdef MM_THREADS
+    if (tcache_put(bp))
+    {
+        UNLOCK();
+        return;
+    }
+#endif
+    heap_free(bp);
+    if (check_every)
+        check_sample();
+    UNLOCK();
+}
+
+/*
+ * mm_realloc
+ * Resize the block at ptr, see heap_realloc
+ * @param: ptr to an allocated payload (or NULL) and the new payload size in bytes
+ * @return: pointer to the resized payload, NULL if size is 0 or the heap is exhausted
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    void *newp;
+
+    if (ptr == NULL)
+        return mm_malloc(size);
+    LOCK_OWNER(ptr);
+    newp = heap_realloc(ptr, size);
+    if (newp == ptr)
+        arena->stats.reallocs_in_place++;
+    else if (newp)
+        arena->stats.reallocs_moved++;
+    if (check_every)
+        check_sample();
+    UNLOCK();
+    return newp;
+}
+
+/*
+ * heap_malloc
  * Allocate space on the heap
  * @param: integer size will determine how many bytes to allocate onto the heap
  * @return: this function returns a pointer to the allocated heap address
  * NOTE: if size is < 0, the function will do nothing. This function will not throw
  *      errors to increase throughput
  */
-void *mm_malloc(size_t size)
+static void *heap_malloc(size_t size)
 {
     size_t asize;      /* adjusted block size */
-    size_t extendsize; /* amount to extend heap if no fit */
     char *bp;
 
     /* Ignore spurious requests */
     if (size <= 0)
         return NULL;
 
+    /* Size classes picked for overflow hunting get a guard page after them */
+    if (guard_mask && GUARDED(adjust_size(size)))
+        return guard_malloc(size);
+
+    /* Tiny requests go to the slab layer, unless it can't take them yet */
+    if (size <= SLAB_MAX && slab_enabled && (bp = slab_malloc(size)) != NULL)
+        return bp;
+
+    /* Huge requests get a region of their own */
+    if (map_threshold && size >= map_threshold)
+        return map_block(size);
+
     /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)
-    {
-        asize = DSIZE + OVERHEAD;
-    }
-    else
+    asize = adjust_size(size);
+    arena->requests++;
+
+    /* A parked block of exactly the right size is still fully set up as an allocated block */
+    if (arena->quick_count && (bp = quick_fit(asize)) != NULL)
+        return bp;
+
+    /* Search the free list for a fit. If that fails while blocks are parked,
+     * coalesce them all and try again before growing the heap */
+    if ((bp = find_fit(asize)) == NULL && arena->quick_count)
     {
-        /* Add overhead and then round up to nearest multiple of double-word alignment */
-        asize = DSIZE * ((size + (OVERHEAD) + (DSIZE - 1)) / DSIZE);
+        quick_flush();
+        bp = find_fit(asize);
     }
-
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL)
+    if (bp != NULL)
     {
         place(bp, asize);
         return bp;
     }
 
     /* No fit found. Get more memory and place the block */
-    extendsize = max(asize, CHUNKSIZE);
-    if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
+    if ((bp = grow_heap(asize)) == NULL)
         return NULL;
 
     place(bp, asize);
@@ -201,7 +811,7 @@ void *mm_malloc(size_t size)
 }
 
 /*
-mm_free
+heap_free
 mark allocated blocks as "free" (e.g. change the header/footer use block to "0")
 AND
 change the first 16 bytes of bp to store the address of a "previous" and "next"
@@ -216,7 +826,56 @@ NOTE:
         will not throw errors to slightly increase speed.
     Postcondition: freed block will be coalese if needed
  */
-void mm_free(void *bp)
+static void heap_free(void *bp)
+{
+    run_t *run;
+
+    // objects of a slab run don't have a header, so they must be recognized by address
+    if ((run = slab_run_of(bp)) != NULL)
+    {
+        slab_free(run, bp);
+        return;
+    }
+
+    // so do guarded payloads, which are not where the header of their block says
+    if (arena->guarded && is_guarded(bp))
+    {
+        guard_free(bp);
+        return;
+    }
+
+    // a mapped block goes straight back to memlib
+    arena->stats.live_bytes -= GET_SIZE(HDRP(bp));
+    if (GET_MAPPED(HDRP(bp)))
+    {
+        mem_unmap(REGIONP(bp), GET_SIZE(HDRP(bp)));
+        return;
+    }
+
+    // in deferred mode the block just gets parked, still marked allocated so that
+    // nobody coalesces with it, and its neighbors don't need to be touched
+    if (coalesce_mode == MM_COALESCE_DEFERRED)
+    {
+        int cls = size_class(GET_SIZE(HDRP(bp)));
+
+        PUT(HDRP(bp), GET(HDRP(bp)) | QUICK);
+        arena->stats.parked_bytes += GET_SIZE(HDRP(bp));
+        SET_PREV_PTR(bp, GET_QUICK(cls));
+        SET_QUICK(cls, bp);
+        if (++arena->quick_count >= QUICK_LIMIT)
+            quick_flush();
+        return;
+    }
+    free_block(bp);
+}
+
+/*
+free_block
+the body of heap_free for ordinary blocks (i.e. anything that is not a slab object)
+@param: pointer to the payload of an allocated block
+@return: nothing
+ */
+static void free_block(void *bp)
 {
     /*
             find the memory chunk "bp" in our heap and set the allocated bit to 0
@@ -233,28 +892,1248 @@ void mm_free(void *bp)
         just  PACK the allocated byte there with 0 instead of 1
         */
 
-    // since PACK require 2 parameter, we grab the size stored in the current header/footer and only change the allocated bit to 0
-    // this is the exact same code as "place", just switch out 1 for 0
-    PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), 0));
-    PUT(FTRP(bp), PACK(GET_SIZE(HDRP(bp)), 0));
+    // since PACK require 2 parameter, we grab the size stored in the current header and only change the allocated bit to 0
+    // the prev-allocated bit stays as it is. A free block needs a footer again, and the
+    // block after it has to learn that its predecessor is now free
+    PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), GET(HDRP(bp)));
+    CLR_PREV_ALLOC(NEXT_BLKP(bp));
 
     // we need to coalesce after freeing,
     // our freed node will be added to the efl in coalesce
-    coalesce(bp);
+    // if that leaves a big free block at the end of the heap, give most of it back
+    trim_heap(coalesce(bp));
+}
+
+/*
+ * heap_realloc
+ * Resize the allocated block at ptr to hold size bytes, keeping its contents
+ * @param: ptr to an allocated payload (or NULL) and the new payload size in bytes
+ * @return: pointer to the resized payload, NULL if size is 0 or the heap is exhausted
+ *
+ * NOTE: we try hard not to move the block, since copying is what makes realloc slow
+ *  1) shrinking splits the tail off as a new free block
+ *  2) growing absorbs the next block if it is free and big enough
+ *  3) if the block is the last one in the heap (maybe followed by one free block),
+ *     the heap is extended by just the missing bytes and those are absorbed
+ *  only when all of that fails do we fall back to malloc + memcpy + free.
+ *  On failure the old block is left untouched, like the libc realloc.
+ *
+ *  With MM_REALLOC_SLACK a block that grows is made bigger than asked for, by
+ *  SLACK_STEPS times the growth (at most doubling it), wherever it ends up, so
+ *  that the next few growths fit in the block itself. To keep that room, such
+ *  a block is only trimmed when it shrinks to half its size or less.
+ */
+static void *heap_realloc(void *ptr, size_t size)
+{
+    size_t asize, oldsize, avail, want;
+    void *next;
+    void *newp;
+    run_t *run;
+
+    if (ptr == NULL)
+        return heap_malloc(size);
+
+    if (size == 0)
+    {
+        heap_free(ptr);
+        return NULL;
+    }
+
+    // a guarded block always moves, so the new one gets a guard page right after it
+    if (arena->guarded && is_guarded(ptr))
+    {
+        oldsize = *(size_t *)PSUB(ptr, GUARD_FRONT);
+        if ((newp = heap_malloc(size)) == NULL)
+            return NULL;
+        memcpy(newp, ptr, size < oldsize ? size : oldsize);
+        guard_free(ptr);
+        return newp;
+    }
+
+    // a slab object has no header, and can only stay put if the new size maps to its own class
+    if ((run = slab_run_of(ptr)) != NULL)
+    {
+        oldsize = SLAB_SIZE(run->cls);
+        if (size <= oldsize && SLAB_CLASS(size) == run->cls)
+            return ptr;
+        if ((newp = heap_malloc(size)) == NULL)
+            return NULL;
+        memcpy(newp, ptr, size < oldsize ? size : oldsize);
+        slab_free(run, ptr);
+        return newp;
+    }
+
+    // a mapped block is resized by memlib as long as it stays huge, and a block
+    // that becomes huge moves to a region right away, where it can grow cheaply.
+    // Either copy is bounded by both sizes: MM_MAP may have changed since the
+    // block was placed, and realloc slack leaves heap blocks bigger than asked
+    if (GET_MAPPED(HDRP(ptr)))
+    {
+        if (map_threshold && size >= map_threshold)
+            return remap_block(ptr, size);
+        oldsize = GET_SIZE(HDRP(ptr)) - ALIGN;
+        if ((newp = heap_malloc(size)) == NULL)
+            return NULL;
+        memcpy(newp, ptr, size < oldsize ? size : oldsize);
+        heap_free(ptr);
+        return newp;
+    }
+    if (map_threshold && size >= map_threshold)
+    {
+        oldsize = GET_SIZE(HDRP(ptr));
+        if ((newp = map_block(size)) == NULL)
+            return NULL;
+        memcpy(newp, ptr, size < oldsize - ALLOC_OVERHEAD ? size : oldsize - ALLOC_OVERHEAD);
+        arena->stats.live_bytes -= oldsize;
+        free_block(ptr);
+        return newp;
+    }
+
+    asize = adjust_size(size);
+    oldsize = GET_SIZE(HDRP(ptr));
+
+    // the size we'd like the block to have, asize plus the slack (if any).
+    // The block may end up twice asize, so it can outgrow a later request
+    want = asize;
+    if (realloc_slack && asize > oldsize)
+        want += (asize - oldsize) * SLACK_STEPS < asize ? (asize - oldsize) * SLACK_STEPS : asize;
+
+    // CASE 1: shrinking (or the block already has enough slack), split off the tail
+    if (asize <= oldsize)
+    {
+        if (!realloc_slack || asize <= oldsize / 2)
+            trim_block(ptr, asize);
+        arena->stats.live_bytes -= oldsize - GET_SIZE(HDRP(ptr));
+        return ptr;
+    }
+
+    // CASE 2: see how far we get by absorbing the next block
+    next = NEXT_BLKP(ptr);
+    avail = oldsize;
+    if (!GET_ALLOC(HDRP(next)))
+        avail += GET_SIZE(HDRP(next));
+
+    // CASE 3: we're at the end of the heap (only the epilogue, or one free block
+    // and the epilogue follow), so ask for just what's missing. The new space
+    // coalesces with the free block after us, if there is one
+    // NOTE: the new space becomes a free block first, so it can't be smaller than MIN_BLOCK
+    if (avail < asize &&
+        (GET_SIZE(HDRP(next)) == 0 ||
+         (!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0)))
+    {
+        if (extend_heap(max(want - avail, MIN_BLOCK)) == NULL)
+            return NULL;
+        avail = oldsize + GET_SIZE(HDRP(next));
+    }
+
+    if (avail >= asize)
+    {
+        if (avail > oldsize)
+            efl_remove(next);
+        PUT(HDRP(ptr), PACK(avail, GET_PREV_ALLOC(HDRP(ptr)) | 1));
+        SET_PREV_ALLOC(NEXT_BLKP(ptr));
+        trim_block(ptr, want < avail ? want : avail);
+        arena->stats.live_bytes += GET_SIZE(HDRP(ptr)) - oldsize;
+        return ptr;
+    }
+
+    // CASE 4: no room to grow in place, move the block
+    if ((newp = heap_malloc(want > asize ? want - ALLOC_OVERHEAD : size)) == NULL)
+        return NULL;
+    memcpy(newp, ptr, oldsize - ALLOC_OVERHEAD);
+    arena->stats.live_bytes -= oldsize;
+    free_block(ptr);
+    return newp;
+}
+
+/*
+ * mm_config
+ * Change a tunable of the allocator, see mm.h for the parameters
+ * @param: param is one of the MM_xxx parameter names, value is its new setting
+ * @return: the previous setting, or -1 if the parameter or value is not recognized.
+ *      MM_GUARD returns 0 instead, since any mask is a valid one (see mm_guard_mask)
+ * NOTE: settings are not reset by mm_init, so they can be picked once before
+ *      running a whole set of traces. Like mm_init, it must not run concurrently
+ *      with any other mm call
+ */
+int mm_config(int param, long value)
+{
+    long old;
+    int i;
+
+    switch (param)
+    {
+    case MM_FIT_POLICY:
+        if (value < 0 || value >= MM_NUM_FITS)
+            return -1;
+        old = fit_policy;
+        fit_policy = (int)value;
+        for (i = 0; i < NUM_ARENAS; i++)
+            arenas[i].rover = NULL;
+        return (int)old;
+
+    case MM_FIT_DEPTH:
+        if (value < 1)
+            return -1;
+        old = fit_depth;
+        fit_depth = value;
+        return (int)old;
+
+    case MM_COALESCE:
+        if (value != MM_COALESCE_IMMEDIATE && value != MM_COALESCE_DEFERRED)
+            return -1;
+        // blocks parked so far have to be coalesced before the mode goes away
+        for (i = 0; i < NUM_ARENAS; i++)
+        {
+            arena = &arenas[i];
+            if (arena->ready && arena->quick_count)
+                quick_flush();
+        }
+        old = coalesce_mode;
+        coalesce_mode = (int)value;
+        return (int)old;
+
+    case MM_TRIM:
+        // the kept part has to be a valid block, so smaller thresholds only mean 0
+        if (value < 0 || (value > 0 && value <= TRIM_KEEP))
+            return -1;
+        old = trim_threshold;
+        trim_threshold = value;
+        return (int)old;
+
+    case MM_MAP:
+        // blocks already mapped stay mapped, mm_free tells them apart by their header
+        if (value < 0)
+            return -1;
+        old = map_threshold;
+        map_threshold = value;
+        return (int)old;
+
+    case MM_REALLOC_SLACK:
+        old = realloc_slack;
+        realloc_slack = value != 0;
+        return (int)old;
+
+    case MM_ORDER:
+        if (value != MM_ORDER_LIFO && value != MM_ORDER_ADDRESS)
+            return -1;
+        // the hints are only kept up in address order, so going back to it
+        // means sorting the lists (and building the hints) from scratch
+        old = list_order;
+        list_order = (int)value;
+        for (i = 0; i < NUM_ARENAS; i++)
+        {
+            arena = &arenas[i];
+            if (arena->ready && list_order == MM_ORDER_ADDRESS && old != MM_ORDER_ADDRESS)
+                sort_lists();
+        }
+        return (int)old;
+
+    case MM_CHECK:
+        if (value < 0)
+            return -1;
+        old = check_every;
+        check_every = value;
+        return (int)old;
+
+    case MM_CHECK_WINDOW:
+        if (value < 0)
+            return -1;
+        old = check_window;
+        check_window = value;
+        return (int)old;
+
+    case MM_GUARD:
+        // guard pages are set up with mprotect, which works on whole pages
+        if (mem_pagesize() != GUARD_PAGE)
+            return -1;
+        guard_mask = value;
+        return 0;
+
+    case MM_SLAB:
+        // only safe to flip between traces, since live slab objects need the layer
+        old = slab_enabled;
+        slab_enabled = value != 0;
+        return (int)old;
+
+    default:
+        return -1;
+    }
+}
+
+/*
+ * mm_guard_mask
+ * The size classes whose blocks are guarded, see mm_config(MM_GUARD)
+ * @param: none
+ * @return: the mask last set, 0 if none
+ */
+long mm_guard_mask(void)
+{
+    return guard_mask;
+}
+
+/*
+ * mm_stats
+ * Report the counters of the allocator, summed over all arenas
+ * @param: the struct to fill in
+ * @return: nothing
+ * NOTE: every counter is kept up to date as blocks come and go, only the
+ *      largest free block is looked up here, at the top of the tree or of the
+ *      highest class that has a block. Blocks sitting in a thread's tcache
+ *      (thread-safe build) count as live
+ */
+void mm_stats(mm_stats_t *stats)
+{
+    int i, cls;
+    size_t largest;
+    void *bp;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < NUM_ARENAS; i++)
+    {
+        arena = &arenas[i];
+#ifdef MM_THREADS
+        pthread_mutex_lock(&arena->lock);
+#endif
+        if (arena->ready)
+        {
+            stats->live_bytes += arena->stats.live_bytes;
+            stats->free_bytes += arena->stats.free_bytes;
+            stats->free_blocks += arena->stats.free_blocks;
+            for (cls = 0; cls < MM_NUM_CLASSES; cls++)
+                stats->class_blocks[cls] += arena->stats.class_blocks[cls];
+            stats->parked_bytes += arena->stats.parked_bytes;
+            stats->parked_blocks += arena->quick_count;
+            stats->splits += arena->stats.splits;
+            stats->coalesces += arena->stats.coalesces;
+            stats->sbrks += arena->stats.sbrks;
+            stats->reallocs_in_place += arena->stats.reallocs_in_place;
+            stats->reallocs_moved += arena->stats.reallocs_moved;
+
+            // the biggest block is the rightmost one of the tree, or if the tree
+            // is empty, it is in the highest class that has any blocks. Only the
+            // power-of-two class has to be searched, the others hold one size
+            largest = 0;
+            if ((bp = GET_HEAD(TREE_ROOT)) != NULL)
+            {
+                while (GET_RIGHT(bp))
+                    bp = GET_RIGHT(bp);
+                largest = GET_SIZE(HDRP(bp));
+            }
+            for (cls = NUM_CLASSES - 1; !largest && cls >= 0; cls--)
+            {
+                for (bp = GET_HEAD(cls); bp; bp = cls < SMALL_CLASSES ? NULL : GET_NXT_PTR(bp))
+                    largest = max(largest, GET_SIZE(HDRP(bp)));
+            }
+            stats->largest_free = max(stats->largest_free, largest);
+
+            // the heap grew by more than was asked for, or was freed at its end
+            bp = PSUB(mem_arena_hi(arena->id), HSIZE - 1);
+            if (!GET_PREV_ALLOC(bp))
+                stats->slack_bytes += GET_SIZE(PSUB(bp, HSIZE));
+        }
+        UNLOCK();
+    }
+    stats->heap_bytes = mem_heapsize();
+    stats->mapped_bytes = mem_mapsize();
+}
+
+/*
+ * mm_check
+ * Run the full heap checker (see check_heap) on every arena
+ * @param: none
+ * @return: 0 if every heap is consistent, -1 otherwise
+ * NOTE: walks every block, so it costs as much as the heap is big. Use
+ *      mm_config(MM_CHECK) to have the checker run as requests come in
+ */
+int mm_check(void)
+{
+    int i;
+    bool ok = true;
+
+    for (i = 0; i < NUM_ARENAS && ok; i++)
+    {
+        arena = &arenas[i];
+#ifdef MM_THREADS
+        pthread_mutex_lock(&arena->lock);
+#endif
+        if (arena->ready)
+            ok = check_heap(__LINE__);
+        UNLOCK();
+    }
+    return ok ? 0 : -1;
 }
 
 /* The remaining routines are internal helper routines */
 
+/*slab_malloc
+ * hand out a slot of the slab class for size
+ * @param: request size in bytes, at most SLAB_MAX
+ * @return: pointer to the slot, or NULL if the class is still warming up or no
+ *  run could be carved, in which case the request goes through the free lists
+ */
+static void *slab_malloc(size_t size)
+{
+    int cls = SLAB_CLASS(size);
+    run_t *run;
+    unsigned int w, slot;
+
+    if (arena->slab_seen[cls] < SLAB_WARMUP)
+    {
+        arena->slab_seen[cls]++;
+        return NULL;
+    }
+
+    if ((run = GET_RUNS(cls)) == NULL && (run = carve_run(cls)) == NULL)
+        return NULL;
+
+    // find the first free slot, a run on the list always has one
+    for (w = 0; !run->free_map[w]; w++)
+        ;
+    slot = w * 64 + __builtin_ctzl(run->free_map[w]);
+    run->free_map[w] &= run->free_map[w] - 1;
+    arena->stats.live_bytes += SLAB_SIZE(cls);
+
+    // a full run leaves the list until one of its slots is freed
+    if (--run->nfree == 0)
+    {
+        SET_RUNS(cls, run->next);
+        if (run->next)
+            run->next->prev = NULL;
+    }
+    return PADD(run, RUN_HDR + slot * SLAB_SIZE(cls));
+}
+
+/*slab_free
+ * give a slot back to its run
+ * @param: the run that holds ptr (see slab_run_of) and the slot pointer
+ * @return: none
+ * NOTE: a run that becomes completely free is returned to the heap, unless
+ *  it is the only run of its class with free slots, so that a class that
+ *  keeps allocating and freeing one object doesn't carve a run every time
+ */
+static void slab_free(run_t *run, void *ptr)
+{
+    int cls = run->cls;
+    unsigned int slot = (unsigned int)((PSUB(ptr, RUN_HDR) - (char *)run) / SLAB_SIZE(cls));
+    unsigned int nslots = (RUN_PAGE - RUN_HDR) / SLAB_SIZE(cls);
+
+    run->free_map[slot / 64] |= 1UL << (slot % 64);
+    arena->stats.live_bytes -= SLAB_SIZE(cls);
+
+    // a full run comes back onto the list of its class
+    if (run->nfree++ == 0)
+    {
+        run->prev = NULL;
+        run->next = GET_RUNS(cls);
+        if (run->next)
+            run->next->prev = run;
+        SET_RUNS(cls, run);
+    }
+
+    if (run->nfree < nslots || (!run->prev && !run->next))
+        return;
+
+    if (run->prev)
+        run->prev->next = run->next;
+    else
+        SET_RUNS(cls, run->next);
+    if (run->next)
+        run->next->prev = run->prev;
+
+    arena->run_pages[PAGE_INDEX(run)] = 0;
+    free_block(run);
+}
+
+/*slab_run_of
+ * find the slab run that ptr points into
+ * @param: any pointer handed out by mm_malloc
+ * @return: the run, or NULL if ptr is an ordinary block
+ * NOTE: run payloads start on a page boundary and are exactly one page long,
+ *  so a slot either lies in the page where its run starts, or (impossible for
+ *  slots, but checked anyway) in the page after it. A run is at least a page
+ *  long, so at most one run starts in any page.
+ */
+static run_t *slab_run_of(void *ptr)
+{
+    size_t page = PAGE_INDEX(ptr);
+
+    if (page >= arena->run_pages_used || !arena->run_pages[page])
+        return NULL;
+    return (run_t *)PSUB(ptr, (size_t)((char *)ptr - (char *)mem_arena_lo(arena->id)) % RUN_PAGE);
+}
+
+/*carve_run
+ * make a new, empty run for slab class cls at the end of the heap
+ * @param: the slab class
+ * @return: the run, now at the head of its class list, or NULL if out of memory
+ *
+ * NOTE: the run has to start on a page boundary. We take the last block of the
+ *  heap if it is free (extending the heap as far as needed), put the run at the
+ *  first page boundary in there that leaves either nothing or a legal free block
+ *  in front of it, and give whatever is left after the run back as a free block.
+ *
+ *   ... | front gap (free) | hdr | run_t | slots ... | tail (free) | epilogue |
+ *       ^ base                   ^ page boundary
+ */
+static run_t *carve_run(int cls)
+{
+    char *lo = mem_arena_lo(arena->id);
+    char *epilogue = PSUB(mem_arena_hi(arena->id), HSIZE - 1);
+    char *base, *page;
+    size_t gap, size, tail, prev_alloc;
+    long shortfall;
+    run_t *run;
+    unsigned int nslots, w;
+    void *bp;
+
+    // the run can start inside the last block if it's free, otherwise right at the epilogue
+    base = GET_PREV_ALLOC(epilogue) ? epilogue : PSUB(epilogue, GET_SIZE(PSUB(epilogue, HSIZE)));
+
+    page = lo + ((size_t)(base + HSIZE - lo) + RUN_PAGE - 1) / RUN_PAGE * RUN_PAGE;
+    gap = (size_t)(page - HSIZE - base);
+    if (gap > 0 && gap < MIN_BLOCK)
+    {
+        page += RUN_PAGE;
+        gap += RUN_PAGE;
+    }
+    if (PAGE_INDEX(page) >= sizeof(arena->run_pages))
+        return NULL;
+
+    // grow the heap until the run (and the epilogue after it) fits
+    shortfall = (long)(page - HSIZE + RUN_BLOCK - epilogue);
+    if (shortfall > 0 && extend_heap(max(shortfall, MIN_BLOCK)) == NULL)
+        return NULL;
+
+    // the free block that starts at base now reaches the end of the heap
+    bp = PADD(base, HSIZE);
+    size = GET_SIZE(HDRP(bp));
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    efl_remove(bp);
+
+    if (gap > 0)
+    {
+        PUT(HDRP(bp), PACK(gap, prev_alloc));
+        PUT(FTRP(bp), GET(HDRP(bp)));
+        efl_push(bp);
+        prev_alloc = 0;
+    }
+
+    bp = page;
+    size -= gap;
+    tail = size - RUN_BLOCK;
+    if (tail < MIN_BLOCK)
+    {
+        PUT(HDRP(bp), PACK(size, prev_alloc | 1));
+        SET_PREV_ALLOC(NEXT_BLKP(bp));
+    }
+    else
+    {
+        PUT(HDRP(bp), PACK(RUN_BLOCK, prev_alloc | 1));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(tail, PREV_ALLOC));
+        PUT(FTRP(NEXT_BLKP(bp)), GET(HDRP(NEXT_BLKP(bp))));
+        efl_push(NEXT_BLKP(bp));
+    }
+
+    // set up the run header with every slot free
+    run = (run_t *)page;
+    nslots = (RUN_PAGE - RUN_HDR) / SLAB_SIZE(cls);
+    run->cls = cls;
+    run->nfree = nslots;
+    for (w = 0; w < sizeof(run->free_map) / sizeof(run->free_map[0]); w++)
+    {
+        if (nslots >= (w + 1) * 64)
+            run->free_map[w] = ~0UL;
+        else if (nslots > w * 64)
+            run->free_map[w] = (1UL << (nslots - w * 64)) - 1;
+        else
+            run->free_map[w] = 0;
+    }
+
+    run->prev = NULL;
+    run->next = GET_RUNS(cls);
+    if (run->next)
+        run->next->prev = run;
+    SET_RUNS(cls, run);
+
+    arena->run_pages[PAGE_INDEX(page)] = cls + 1;
+    arena->run_pages_used = max(arena->run_pages_used, PAGE_INDEX(page) + 1);
+    return run;
+}
+
+/*map_block
+ * give a huge request a mapped region of its own
+ * @param: request size in bytes
+ * @return: pointer to the payload, or NULL if memlib has no room
+ * NOTE: the header records the size of the whole region, which is what
+ *  mem_unmap and mem_remap need to hear back
+ */
+static void *map_block(size_t size)
+{
+    size_t rsize = (size + ALIGN + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    char *region;
+
+    if (rsize > MAX_BLOCK || (region = mem_map(rsize)) == NULL)
+        return NULL;
+    arena->stats.live_bytes += rsize;
+    PUT(HDRP(PADD(region, ALIGN)), PACK(rsize, MAPPED | 1));
+    return PADD(region, ALIGN);
+}
+
+/*remap_block
+ * resize the region of a mapped block to hold size bytes
+ * @param: payload of a mapped block and its new size in bytes
+ * @return: the payload, which may have moved, or NULL if memlib has no room,
+ *  in which case the block is left as it was
+ */
+static void *remap_block(void *bp, size_t size)
+{
+    size_t rsize = (size + ALIGN + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    size_t oldsize = GET_SIZE(HDRP(bp));
+    char *region;
+
+    if (rsize == oldsize)
+        return bp;
+    if (rsize > MAX_BLOCK || (region = mem_remap(REGIONP(bp), oldsize, rsize)) == NULL)
+        return NULL;
+    arena->stats.live_bytes += rsize - oldsize;
+    PUT(HDRP(PADD(region, ALIGN)), PACK(rsize, MAPPED | 1));
+    return PADD(region, ALIGN);
+}
+
+/*guard_malloc
+ * hand out a block whose payload ends right at a guard page, for overflow hunting
+ * @param: request size in bytes
+ * @return: pointer to the payload, or NULL if out of memory
+ *
+ * NOTE: the payload starts ROUND_UP(size) bytes in front of a page boundary,
+ *  and the page after the boundary is turned into a guard area with mem_guard,
+ *  so that running off the end of the payload faults right away. Overruns too
+ *  small to reach the guard land in the fill bytes, and underruns in the
+ *  canary, which guard_intact checks when the block is freed and whenever the
+ *  heap checker walks past it. Like carve_run, we pick the first boundary in a
+ *  free block that leaves nothing or a legal free block in front of the block:
+ *
+ *   ... | front gap (free) | hdr | size | canary | payload | fill | guard page | pad | ...
+ *                                               ^ aligned         ^ page boundary
+ */
+static void *guard_malloc(size_t size)
+{
+    char *lo = mem_arena_lo(arena->id);
+    size_t bsize = GUARD_BLOCK(size);
+    size_t asize = bsize + GUARD_PAGE + MIN_BLOCK; /* room for any front gap */
+    size_t fsize, gap, prev_alloc;
+    char *bp, *guard, *payload;
+
+    if (bsize > MAX_BLOCK)
+        return NULL;
+    arena->requests++;
+    if ((bp = find_fit(asize)) == NULL && arena->quick_count)
+    {
+        quick_flush();
+        bp = find_fit(asize);
+    }
+    if (bp == NULL && (bp = grow_heap(asize)) == NULL)
+        return NULL;
+
+    // the first page boundary the payload can end at
+    guard = lo + ((size_t)(bp + GUARD_FRONT + ROUND_UP(size) - lo) + GUARD_PAGE - 1) / GUARD_PAGE * GUARD_PAGE;
+    gap = (size_t)(guard - ROUND_UP(size) - GUARD_FRONT - bp);
+    if (gap > 0 && gap < MIN_BLOCK)
+    {
+        guard += GUARD_PAGE;
+        gap += GUARD_PAGE;
+    }
+    if (PAGE_INDEX(guard) >= sizeof(arena->guard_at) / sizeof(arena->guard_at[0]))
+        return NULL;
+
+    // split the front gap off the free block, and place the guarded block in the rest
+    fsize = GET_SIZE(HDRP(bp));
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    if (gap > 0)
+    {
+        efl_remove(bp);
+        PUT(HDRP(bp), PACK(gap, prev_alloc));
+        PUT(FTRP(bp), GET(HDRP(bp)));
+        efl_push(bp);
+        bp = PADD(bp, gap);
+        PUT(HDRP(bp), PACK(fsize - gap, 0));
+        PUT(FTRP(bp), GET(HDRP(bp)));
+        efl_push(bp);
+    }
+    place(bp, bsize);
+
+    payload = PADD(bp, GUARD_FRONT);
+    *(size_t *)bp = size;
+    *(size_t *)PSUB(payload, sizeof(size_t)) = GUARD_CANARY ^ (size_t)payload;
+    memset(PADD(payload, size), GUARD_FILL, ROUND_UP(size) - size);
+    if (mem_guard(guard, GUARD_PAGE) < 0)
+    {
+        heap_free(bp);
+        return NULL;
+    }
+    arena->guard_at[PAGE_INDEX(payload)] = 1 + (size_t)(payload - lo) % GUARD_PAGE / ALIGN;
+    arena->guarded++;
+    return payload;
+}
+
+/*guard_free
+ * free a block handed out by guard_malloc, after making sure it was not overrun
+ * @param: the payload
+ * @return: none
+ * NOTE: a block that was written out of bounds stops the program, since the
+ *  point of guard blocks is to find the culprit as close to the crime as we can
+ */
+static void guard_free(void *ptr)
+{
+    char *bp = PSUB(ptr, GUARD_FRONT);
+
+    if (!guard_intact(ptr))
+    {
+        printf("mm_free: guarded block %p (%zu bytes) was written out of bounds\n",
+               ptr, *(size_t *)bp);
+        fflush(stdout);
+        abort();
+    }
+    mem_unguard(PADD(ptr, ROUND_UP(*(size_t *)bp)), GUARD_PAGE);
+    arena->guard_at[PAGE_INDEX(ptr)] = 0;
+    arena->guarded--;
+    heap_free(bp);
+}
+
+/*is_guarded
+ * tell whether ptr is the payload of a guarded block of the current arena
+ * @param: any pointer handed out by mm_malloc
+ * @return: true if guard_malloc handed it out
+ */
+static bool is_guarded(void *ptr)
+{
+    size_t page = PAGE_INDEX(ptr);
+    size_t offset = (size_t)((char *)ptr - (char *)mem_arena_lo(arena->id)) % GUARD_PAGE;
+
+    return page < sizeof(arena->guard_at) / sizeof(arena->guard_at[0]) &&
+           arena->guard_at[page] == 1 + offset / ALIGN && offset % ALIGN == 0;
+}
+
+/*guard_intact
+ * check the canary, the recorded size and the fill bytes of a guarded block
+ * @param: the payload of a guarded block
+ * @return: true if nothing around the payload was overwritten
+ */
+static bool guard_intact(void *ptr)
+{
+    char *bp = PSUB(ptr, GUARD_FRONT);
+    size_t size = *(size_t *)bp;
+    unsigned char *fill;
+
+    if (*(size_t *)PSUB(ptr, sizeof(size_t)) != (GUARD_CANARY ^ (size_t)ptr) ||
+        GET_SIZE(HDRP(bp)) < GUARD_BLOCK(size))
+        return false;
+    for (fill = (unsigned char *)PADD(ptr, size); fill < (unsigned char *)PADD(ptr, ROUND_UP(size)); fill++)
+    {
+        if (*fill != GUARD_FILL)
+            return false;
+    }
+    return true;
+}
+
+#ifdef MM_THREADS
+/*lock_arena
+ * lock an arena for a new block and make it the current one
+ * @param: none
+ * @return: the arena, or NULL if its heap could not be set up
+ * NOTE: a thread sticks to its home arena, handed out round robin. If that one
+ *  is busy, it tries each other arena once and moves its home to the first one
+ *  it gets, so that threads spread out under contention. Only if all of them
+ *  are busy does it wait for its own
+ */
+static arena_t *lock_arena(void)
+{
+    arena_t *a = home;
+    int i;
+
+    if (a == NULL)
+        a = &arenas[__atomic_fetch_add(&next_home, 1, __ATOMIC_RELAXED) % NUM_ARENAS];
+    if (pthread_mutex_trylock(&a->lock) != 0)
+    {
+        for (i = 1; i < NUM_ARENAS; i++)
+        {
+            if (pthread_mutex_trylock(&arenas[(a->id + i) % NUM_ARENAS].lock) == 0)
+                break;
+        }
+        if (i < NUM_ARENAS)
+            a = &arenas[(a->id + i) % NUM_ARENAS];
+        else
+            pthread_mutex_lock(&a->lock);
+    }
+
+    arena = a;
+    if (!a->ready && arena_init() < 0)
+    {
+        pthread_mutex_unlock(&a->lock);
+        return NULL;
+    }
+    home = a;
+    return a;
+}
+
+/*lock_owner
+ * lock the arena that bp was allocated from and make it the current one
+ * @param: a payload handed out by mm_malloc or mm_realloc
+ * @return: the arena
+ * NOTE: a block in a mapped region belongs to no arena, any arena that is set
+ *  up can free or resize it, so we take the home arena (or arena 0)
+ */
+static arena_t *lock_owner(void *bp)
+{
+    int id = mem_arena_of(bp);
+
+    if (id >= 0)
+        arena = &arenas[id];
+    else
+        arena = home ? home : &arenas[0];
+    pthread_mutex_lock(&arena->lock);
+    return arena;
+}
+
+/*tcache_bin
+ * the tcache bin for heap blocks of size bytes
+ * @param: block size in bytes
+ * @return: the bin, or -1 if blocks that big aren't cached
+ * NOTE: only the exact list classes are cached, so all blocks in a bin have the
+ *  same size and any of them fits
+ */
+static int tcache_bin(size_t size)
+{
+    return size < SMALL_LIMIT ? SLAB_CLASSES + size_class(size) : -1;
+}
+
+/*tcache_get
+ * take a block for a request of size bytes from the calling thread's tcache
+ * @param: request size in bytes
+ * @return: the payload, or NULL if the tcache has nothing that fits
+ * NOTE: runs without the heap lock, the blocks in the bins belong to this thread
+ */
+static void *tcache_get(size_t size)
+{
+    int bin = -1;
+    void *bp;
+
+    // the heap was reset since this thread last cached anything
+    if (tcache.generation != heap_generation)
+    {
+        memset(tcache.bins, 0, sizeof(tcache.bins));
+        memset(tcache.counts, 0, sizeof(tcache.counts));
+        tcache.generation = heap_generation;
+        return NULL;
+    }
+
+    // tiny requests take a slab object or, if none is cached, a heap block.
+    // With guard blocks in use, every request goes to guard_malloc's check
+    if (size == 0 || guard_mask)
+        return NULL;
+    if (size <= SLAB_MAX && tcache.bins[SLAB_CLASS(size)])
+        bin = SLAB_CLASS(size);
+    else if (size < SMALL_LIMIT)
+        bin = tcache_bin(adjust_size(size));
+    if (bin < 0 || (bp = tcache.bins[bin]) == NULL)
+        return NULL;
+
+    tcache.bins[bin] = TCACHE_NEXT(bp);
+    tcache.counts[bin]--;
+    return bp;
+}
+
+/*tcache_put
+ * keep a freed block in the calling thread's tcache
+ * @param: a payload handed out by mm_malloc or mm_realloc
+ * @return: true if the block was cached, false if it has to be freed for real
+ * NOTE: the caller holds the lock of the block's arena (LOCK_OWNER), other
+ *  threads change the slab page map and the neighbours' view of this header
+ *  under it
+ */
+static bool tcache_put(void *bp)
+{
+    run_t *run;
+    int bin;
+
+    // blocks in mapped regions are never cached
+    if (tcache.generation != heap_generation || mem_arena_of(bp) < 0)
+        return false;
+
+    // slab_run_of looks in the current arena, which LOCK_OWNER made the block's
+    // own. Guarded blocks are checked when they are freed, so none are cached
+    if (guard_mask)
+        return false;
+    if ((run = slab_run_of(bp)) != NULL)
+        bin = run->cls;
+    else if ((bin = tcache_bin(GET_SIZE(HDRP(bp)))) < 0)
+        return false;
+    if (tcache.counts[bin] >= TCACHE_COUNT)
+        return false;
+
+    // make sure the thread hands its blocks back when it exits
+    if (!tcache.registered)
+    {
+        pthread_once(&tcache_once, tcache_key_init);
+        pthread_setspecific(tcache_key, &tcache);
+        tcache.registered = true;
+    }
+
+    TCACHE_NEXT(bp) = tcache.bins[bin];
+    tcache.bins[bin] = bp;
+    tcache.counts[bin]++;
+    return true;
+}
+
+/*tcache_flush
+ * free every block in the calling thread's tcache, run when the thread exits
+ * @param: the tcache_key value, unused
+ * @return: none
+ * NOTE: the blocks may come from several arenas, each goes back to its own
+ */
+static void tcache_flush(void *unused)
+{
+    int bin;
+    void *bp;
+
+    if (tcache.generation != heap_generation)
+        return;
+    for (bin = 0; bin < TCACHE_BINS; bin++)
+    {
+        while ((bp = tcache.bins[bin]) != NULL)
+        {
+            tcache.bins[bin] = TCACHE_NEXT(bp);
+            LOCK_OWNER(bp);
+            heap_free(bp);
+            UNLOCK();
+        }
+        tcache.counts[bin] = 0;
+    }
+}
+
+/*tcache_key_init
+ * create the key whose destructor flushes a thread's tcache
+ */
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+#endif
+
+/*quick_fit
+ * take a parked block of exactly asize bytes off the quick list for its class
+ * @param: block size in bytes
+ * @return: the block, ready to be handed out, or NULL if none was found within
+ *  the first QUICK_SCAN blocks of the list
+ * NOTE: the quick lists are singly linked through the prev word, since blocks
+ *  only ever leave them from here or all at once in quick_flush
+ */
+static void *quick_fit(size_t asize)
+{
+    int cls = size_class(asize);
+    void *bp = GET_QUICK(cls);
+    void *prev = NULL;
+    int scanned;
+
+    for (scanned = 0; bp && scanned < QUICK_SCAN; scanned++)
+    {
+        PREFETCH(GET_PREV_PTR(bp));
+        if (GET_SIZE(HDRP(bp)) == asize)
+        {
+            if (prev)
+                SET_PREV_PTR(prev, GET_PREV_PTR(bp));
+            else
+                SET_QUICK(cls, GET_PREV_PTR(bp));
+            PUT(HDRP(bp), GET(HDRP(bp)) & ~(hdr_t)QUICK);
+            arena->quick_count--;
+            arena->stats.parked_bytes -= asize;
+            arena->stats.live_bytes += asize;
+            return bp;
+        }
+        prev = bp;
+        bp = GET_PREV_PTR(bp);
+    }
+    return NULL;
+}
+
+/*quick_flush
+ * really free every parked block, coalescing them in one batch
+ * @param: none
+ * @return: none
+ * NOTE: a parked neighbor still looks allocated when its block is freed, and is
+ *  merged in when its own turn comes
+ */
+static void quick_flush(void)
+{
+    int i;
+    void *bp;
+    void *nxt;
+
+    for (i = 0; i < QUICK_LISTS; i++)
+    {
+        for (bp = GET_QUICK(i); bp; bp = nxt)
+        {
+            nxt = GET_PREV_PTR(bp);
+            PUT(HDRP(bp), GET(HDRP(bp)) & ~(hdr_t)QUICK);
+            free_block(bp);
+        }
+        SET_QUICK(i, NULL);
+    }
+    arena->quick_count = 0;
+    arena->stats.parked_bytes = 0;
+}
+
+/*size_class
+ * map a block size onto the index of the segregated list that holds it
+ * @param: block size in bytes (header and footer included)
+ * @return: index in [0, NUM_CLASSES), or TREE_ROOT for blocks of the tree
+ * NOTE: below SMALL_LIMIT every doubleword multiple has its own class. Above
+ *  it the index is just the position of the highest set bit, shifted so that
+ *  SMALL_LIMIT lands right after the exact classes
+ */
+static int size_class(size_t size)
+{
+    if (size < SMALL_LIMIT)
+        return (int)((size - MIN_BLOCK) / ALIGN);
+    if (size >= TREE_MIN)
+        return TREE_ROOT;
+
+    return SMALL_CLASSES + (int)(8 * sizeof(size_t) - 1 - __builtin_clzl(size)) - SMALL_SHIFT;
+}
+
+/*splay
+ * top-down splay of the subtree t on size (Sleator and Tarjan)
+ * @param: root of a subtree and the size to look for
+ * @return: the new root of the subtree, which is the node of that size if there
+ *  is one, otherwise the last node visited on the way to where it would be
+ *  (i.e. its predecessor or successor)
+ * NOTE: the left and right trees being built are hung off a fake node that
+ *  lives on our stack, laid out like a tree block so the link macros work on it
+ */
+static void *splay(void *t, size_t size)
+{
+    size_t fake[4] = {0, 0, 0, 0};
+    void *l = fake;
+    void *r = fake;
+    void *y;
+
+    if (!t)
+        return t;
+
+    for (;;)
+    {
+        PREFETCH(GET_LEFT(t));
+        PREFETCH(GET_RIGHT(t));
+        if (size < GET_SIZE(HDRP(t)))
+        {
+            if (!GET_LEFT(t))
+                break;
+            // rotate right
+            if (size < GET_SIZE(HDRP(GET_LEFT(t))))
+            {
+                y = GET_LEFT(t);
+                SET_LEFT(t, GET_RIGHT(y));
+                SET_RIGHT(y, t);
+                t = y;
+                if (!GET_LEFT(t))
+                    break;
+            }
+            // link right
+            SET_LEFT(r, t);
+            r = t;
+            t = GET_LEFT(t);
+        }
+        else if (size > GET_SIZE(HDRP(t)))
+        {
+            if (!GET_RIGHT(t))
+                break;
+            // rotate left
+            if (size > GET_SIZE(HDRP(GET_RIGHT(t))))
+            {
+                y = GET_RIGHT(t);
+                SET_RIGHT(t, GET_LEFT(y));
+                SET_LEFT(y, t);
+                t = y;
+                if (!GET_RIGHT(t))
+                    break;
+            }
+            // link left
+            SET_RIGHT(l, t);
+            l = t;
+            t = GET_RIGHT(t);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // assemble
+    SET_RIGHT(l, GET_LEFT(t));
+    SET_LEFT(r, GET_RIGHT(t));
+    SET_LEFT(t, GET_RIGHT((void *)fake));
+    SET_RIGHT(t, GET_LEFT((void *)fake));
+    return t;
+}
+
+/*tree_insert
+ * add a free block of at least TREE_MIN bytes to the tree
+ * @param: pointer to the free block, its header must hold its final size
+ * @return: none
+ * NOTE: if a block of the same size is already in the tree, bp just goes into
+ *  the list behind it and the shape of the tree doesn't change
+ */
+static void tree_insert(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    void *root = splay(GET_HEAD(TREE_ROOT), size);
+
+    if (root && GET_SIZE(HDRP(root)) == size)
+    {
+        SET_PREV_PTR(bp, root);
+        SET_NXT_PTR(bp, GET_NXT_PTR(root));
+        if (GET_NXT_PTR(root))
+            SET_PREV_PTR(GET_NXT_PTR(root), bp);
+        SET_NXT_PTR(root, bp);
+        SET_HEAD(TREE_ROOT, root);
+        return;
+    }
+
+    SET_PREV_PTR(bp, NULL);
+    SET_NXT_PTR(bp, NULL);
+    if (!root)
+    {
+        SET_LEFT(bp, NULL);
+        SET_RIGHT(bp, NULL);
+    }
+    else if (size < GET_SIZE(HDRP(root)))
+    {
+        SET_LEFT(bp, GET_LEFT(root));
+        SET_RIGHT(bp, root);
+        SET_LEFT(root, NULL);
+    }
+    else
+    {
+        SET_RIGHT(bp, GET_RIGHT(root));
+        SET_LEFT(bp, root);
+        SET_RIGHT(root, NULL);
+    }
+    SET_HEAD(TREE_ROOT, bp);
+}
+
+/*tree_remove
+ * take a free block out of the tree
+ * @param: pointer to a free block that is in the tree
+ * @return: none
+ */
+static void tree_remove(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    void *root;
+    void *nxt = GET_NXT_PTR(bp);
+
+    // CASE 1: bp is in the list behind a tree node, a plain list removal
+    if (GET_PREV_PTR(bp))
+    {
+        SET_NXT_PTR(GET_PREV_PTR(bp), nxt);
+        if (nxt)
+            SET_PREV_PTR(nxt, GET_PREV_PTR(bp));
+        return;
+    }
+
+    // bp is the tree node for its size, bring it up to the root (tree_fit
+    // usually left it there already)
+    root = GET_HEAD(TREE_ROOT);
+    if (root != bp)
+        root = splay(root, size);
+
+    // CASE 2: another block of the same size takes its place in the tree
+    if (nxt)
+    {
+        SET_PREV_PTR(nxt, NULL);
+        SET_LEFT(nxt, GET_LEFT(root));
+        SET_RIGHT(nxt, GET_RIGHT(root));
+        SET_HEAD(TREE_ROOT, nxt);
+        return;
+    }
+
+    // CASE 3: the node goes away, join its subtrees. Splaying the left subtree on
+    // size brings up its biggest node, which has no right child
+    if (!GET_LEFT(root))
+    {
+        SET_HEAD(TREE_ROOT, GET_RIGHT(root));
+    }
+    else
+    {
+        void *left = splay(GET_LEFT(root), size);
+        SET_RIGHT(left, GET_RIGHT(root));
+        SET_HEAD(TREE_ROOT, left);
+    }
+}
+
+/*tree_fit
+ * best fit search in the tree
+ * @param: block size in bytes
+ * @return: the smallest free block in the tree of at least asize bytes, or NULL
+ */
+static void *tree_fit(size_t asize)
+{
+    void *root = splay(GET_HEAD(TREE_ROOT), asize);
+    void *bp;
+
+    SET_HEAD(TREE_ROOT, root);
+    if (!root)
+        return NULL;
+
+    // after the splay the root is either the best fit or its predecessor, in
+    // which case the best fit is the smallest node of the right subtree. Splay
+    // that one up too, so that removing it right after is cheap
+    if (GET_SIZE(HDRP(root)) >= asize)
+        bp = root;
+    else if ((bp = GET_RIGHT(root)) != NULL)
+    {
+        while (GET_LEFT(bp))
+            bp = GET_LEFT(bp);
+        SET_HEAD(TREE_ROOT, splay(root, GET_SIZE(HDRP(bp))));
+    }
+
+    // prefer a block from the list behind the node, it leaves without touching the tree
+    if (bp && GET_NXT_PTR(bp))
+        return GET_NXT_PTR(bp);
+    return bp;
+}
+
 /*efl_push
- * add a new node to the head of the explicit freed list
+ * add a new node to the head of the explicit freed list for its size class,
+ * or to the tree for blocks of at least TREE_MIN bytes
  * @param: pointer to the new head of explicit free list
  * @return: none
  *  NOTE: this will ALSO write the address of the newly freed memory chunk
- *  into the padding block (head of explicit free list)
+ *  into the padding block (head of its class list), so the header of bp
+ *  must already hold its final size
  */
 static void efl_push(void *bp)
 {
-    void *head = GET_START;
+    int cls = size_class(GET_SIZE(HDRP(bp)));
+    void *head;
+
+    arena->stats.free_bytes += GET_SIZE(HDRP(bp));
+    arena->stats.free_blocks++;
+    arena->stats.class_blocks[cls]++;
+    if (cls == TREE_ROOT)
+    {
+        tree_insert(bp);
+        return;
+    }
+    if (list_order == MM_ORDER_ADDRESS)
+    {
+        efl_insert(bp, cls);
+        return;
+    }
+
+    head = GET_HEAD(cls);
 
     // if the current head is not NULL, set its prev node to bp
     if (head)
@@ -269,22 +2148,58 @@ static void efl_push(void *bp)
     SET_NXT_PTR(bp, head);
 
     // // write the new address to the padding bytes
-    SET_START(bp);
+    SET_HEAD(cls, bp);
 }
 
-/*efl_remove
- *remove a node from the efl
- *@param: node pointer to be removed
- *@return: none
- *NOTE: this is just a simple node removal of a doubly linked list
- */
-static void efl_remove(void *bp)
-{
+/*efl_remove
+ *remove a node from the efl of its size class (or from the tree)
+ *@param: node pointer to be removed
+ *@return: none
+ *NOTE: this is just a simple node removal of a doubly linked list. The header
+ *  of bp must still hold the size it was pushed with, so call this BEFORE
+ *  rewriting the header of a block that is leaving the list
+ */
+static void efl_remove(void *bp)
+{
+    int cls = size_class(GET_SIZE(HDRP(bp)));
+
+    arena->stats.free_bytes -= GET_SIZE(HDRP(bp));
+    arena->stats.free_blocks--;
+    arena->stats.class_blocks[cls]--;
+
+    // a block that leaves the list may be about to merge into a neighbor, so the
+    // sampled heap check must not resume from it
+    if (bp == arena->check_cursor)
+        arena->check_cursor = NULL;
+    if (cls == TREE_ROOT)
+    {
+        tree_remove(bp);
+        return;
+    }
+
+    // don't leave the next fit rover pointing at a block that is leaving the list
+    if (bp == arena->rover)
+        arena->rover = GET_NXT_PTR(bp);
+
+    // nor a hint, the next block takes over if it is in the same region
+    if (list_order == MM_ORDER_ADDRESS && arena->hints[cls][HINT_REGION(bp)] == bp)
+    {
+        size_t r = HINT_REGION(bp);
+        void *nxt = GET_NXT_PTR(bp);
+
+        if (nxt && HINT_REGION(nxt) == r)
+            arena->hints[cls][r] = nxt;
+        else
+        {
+            arena->hints[cls][r] = NULL;
+            arena->hint_map[cls][r / 64] &= ~(1UL << (r % 64));
+        }
+    }
 
     // CASE 1: when bp is the ONLY node in the efl
     if (!GET_PREV_PTR(bp) && !GET_NXT_PTR(bp))
     {
-        SET_START(NULL);
+        SET_HEAD(cls, NULL);
     }
     // CASE 2: when removing from the head, but the list size > 1
 
@@ -292,7 +2207,7 @@ static void efl_remove(void *bp)
     {
         void *new_head = GET_NXT_PTR(bp);
         SET_PREV_PTR(new_head, NULL);
-        SET_START(new_head);
+        SET_HEAD(cls, new_head);
     }
 
     else if (!GET_NXT_PTR(bp))
@@ -311,6 +2226,140 @@ static void efl_remove(void *bp)
         SET_PREV_PTR(nxt, prev);
     }
 }
+/*efl_insert
+ * add a free block to the list of class cls, keeping the list sorted by address
+ * @param: pointer to the free block and its (list) class
+ * @return: none
+ * NOTE: instead of walking the list from its head, we start from the hints. If
+ *  the region of bp already has blocks and the first of them is below bp, only
+ *  the blocks of that region are walked. Otherwise bp becomes the first block
+ *  of its region and goes right in front of the first block of the next region
+ *  that has any, which the bitmap finds in a few word operations. Only if there
+ *  is none do we walk the last region that has blocks, to find the tail
+ */
+static void efl_insert(void *bp, int cls)
+{
+    size_t r = HINT_REGION(bp);
+    void *prev = NULL;
+    void *next = arena->hints[cls][r];
+    long other;
+
+    if (next && next < bp)
+    {
+        do
+        {
+            prev = next;
+            next = GET_NXT_PTR(prev);
+        } while (next && next < bp);
+    }
+    else
+    {
+        if (!next && (other = hint_after(cls, r)) >= 0)
+            next = arena->hints[cls][other];
+        if (next)
+            prev = GET_PREV_PTR(next);
+        else if ((other = hint_before(cls, r)) >= 0)
+        {
+            for (prev = arena->hints[cls][other]; GET_NXT_PTR(prev); prev = GET_NXT_PTR(prev))
+                ;
+        }
+        arena->hints[cls][r] = bp;
+        arena->hint_map[cls][r / 64] |= 1UL << (r % 64);
+    }
+
+    SET_PREV_PTR(bp, prev);
+    SET_NXT_PTR(bp, next);
+    if (prev)
+        SET_NXT_PTR(prev, bp);
+    else
+        SET_HEAD(cls, bp);
+    if (next)
+        SET_PREV_PTR(next, bp);
+}
+
+/*hint_after
+ * the first region after region that has a block of class cls
+ * @return: the region, or -1 if there is none
+ */
+static long hint_after(int cls, size_t region)
+{
+    unsigned long *map = arena->hint_map[cls];
+    size_t w;
+    unsigned long bits;
+
+    if (++region >= HINT_REGIONS)
+        return -1;
+    w = region / 64;
+    for (bits = map[w] & (~0UL << (region % 64)); !bits; bits = map[w])
+    {
+        if (++w >= HINT_WORDS)
+            return -1;
+    }
+    return (long)(w * 64 + __builtin_ctzl(bits));
+}
+
+/*hint_before
+ * the last region before region that has a block of class cls
+ * @return: the region, or -1 if there is none
+ */
+static long hint_before(int cls, size_t region)
+{
+    unsigned long *map = arena->hint_map[cls];
+    size_t w = region / 64;
+    unsigned long bits;
+
+    for (bits = map[w] & ((1UL << (region % 64)) - 1); !bits; bits = map[w])
+    {
+        if (w-- == 0)
+            return -1;
+    }
+    return (long)(w * 64 + 63 - __builtin_clzl(bits));
+}
+
+/*sort_lists
+ * rebuild the list classes of the current arena in address order, with their hints
+ * @param: none
+ * @return: none
+ * NOTE: a walk over the heap meets the free blocks in address order, so each one
+ *  just goes to the tail of its class. The tree and the counters don't change
+ */
+static void sort_lists(void)
+{
+    void *tails[NUM_CLASSES];
+    void *bp;
+    size_t r;
+    int cls;
+
+    for (cls = 0; cls < NUM_CLASSES; cls++)
+    {
+        SET_HEAD(cls, NULL);
+        tails[cls] = NULL;
+    }
+    memset(arena->hints, 0, sizeof(arena->hints));
+    memset(arena->hint_map, 0, sizeof(arena->hint_map));
+    arena->rover = NULL;
+
+    for (bp = NEXT_BLKP(arena->heap_start); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    {
+        if (GET_ALLOC(HDRP(bp)) || (cls = size_class(GET_SIZE(HDRP(bp)))) == TREE_ROOT)
+            continue;
+        SET_PREV_PTR(bp, tails[cls]);
+        SET_NXT_PTR(bp, NULL);
+        if (tails[cls])
+            SET_NXT_PTR(tails[cls], bp);
+        else
+            SET_HEAD(cls, bp);
+        tails[cls] = bp;
+
+        r = HINT_REGION(bp);
+        if (!arena->hints[cls][r])
+        {
+            arena->hints[cls][r] = bp;
+            arena->hint_map[cls][r / 64] |= 1UL << (r % 64);
+        }
+    }
+}
+
 /*
  * place -- Check if bp block can be split to accomodate asize bytes, then
             place block of asize bytes at start of free block bp
@@ -335,11 +2384,12 @@ static void place(void *bp, size_t asize)
 
     // efl_remove(bp);
     // bp is too small, don't split
-    if (current_size - asize < 32)
+    if (current_size - asize < MIN_BLOCK)
     {
-        PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), 1));
-        PUT(FTRP(bp), PACK(GET_SIZE(HDRP(bp)), 1));
         efl_remove(bp);
+        PUT(HDRP(bp), PACK(current_size, GET_PREV_ALLOC(HDRP(bp)) | 1));
+        SET_PREV_ALLOC(NEXT_BLKP(bp));
+        arena->stats.live_bytes += current_size;
     }
 
     else
@@ -362,12 +2412,14 @@ static void place(void *bp, size_t asize)
              then go to the next block, and give it the "remaining size"
         */
 
-        // allocate the new header and footer and then remove bp from efl
+        // remove bp from efl and then allocate the new header and footer
         // NOTE: removing from efl here makes it possible to treat the splitted off portion
-        //      as its own entity.
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+        //      as its own entity. It has to happen first since the class of bp
+        //      is computed from the size that is still in its header.
         efl_remove(bp);
+        PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+        arena->stats.live_bytes += asize;
+        arena->stats.splits++;
 
         /*
         Go to the next block
@@ -383,12 +2435,14 @@ static void place(void *bp, size_t asize)
         bp = NEXT_BLKP(bp);
 
         size_t remaining = current_size - asize;
-        // need to make this a HEADER block
-        PUT(HDRP(bp), PACK(remaining, 0));
+        // need to make this a HEADER block, its predecessor is the block we just allocated
+        // NOTE: the block after it already has its prev-allocated bit clear, since
+        //      it used to follow the free block bp
+        PUT(HDRP(bp), PACK(remaining, PREV_ALLOC));
 
         // now calculate the FTR block and pack that with the right info
         // both blocks are still freed
-        PUT(FTRP(bp), PACK(remaining, 0));
+        PUT(FTRP(bp), PACK(remaining, PREV_ALLOC));
 
         // we handle all of our splitting removal in coalesce to minimize the amount of
         // access point into our efl.
@@ -396,6 +2450,64 @@ static void place(void *bp, size_t asize)
     }
 }
 
+/*
+ * trim_block -- Shrink the allocated block bp down to asize bytes, turning
+ *      the tail into a free block if it is big enough to be one
+ *
+ * @param: pointer to an allocated block and its new size (asize <= its size)
+ * @return: nothing
+ *
+ * NOTE: the tail is coalesced, so it merges with a free block that follows it
+ */
+static void trim_block(void *bp, size_t asize)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+
+    // not enough left over for a block of its own, keep it as internal fragmentation
+    if (size - asize < MIN_BLOCK)
+        return;
+
+    PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    arena->stats.splits++;
+
+    bp = NEXT_BLKP(bp);
+    PUT(HDRP(bp), PACK(size - asize, PREV_ALLOC));
+    PUT(FTRP(bp), GET(HDRP(bp)));
+    CLR_PREV_ALLOC(NEXT_BLKP(bp));
+    trim_heap(coalesce(bp));
+}
+
+/*
+ * trim_heap -- Give the end of the heap back to memlib if bp is a big free
+ *      block right before the epilogue
+ *
+ * @param: pointer to a free block that is on the free lists
+ * @return: nothing
+ *
+ * NOTE: the first TRIM_KEEP bytes stay in the heap as a smaller free block, so
+ *      that a process that frees and then allocates a little does not call
+ *      mem_sbrk every time
+ */
+static void trim_heap(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (!trim_threshold || size < trim_threshold || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+        return;
+
+    efl_remove(bp);
+    if ((long)mem_arena_sbrk(arena->id, -(int)(size - TRIM_KEEP)) < 0)
+    {
+        efl_push(bp);
+        return;
+    }
+    arena->stats.sbrks++;
+    PUT(HDRP(bp), PACK(TRIM_KEEP, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), GET(HDRP(bp)));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+    efl_push(bp);
+}
+
 /*
  * coalesce -- Boundary tag coalescing.
  * Takes a pointer to a free block
@@ -422,9 +2534,13 @@ static void *coalesce(void *bp)
 
     // check if the block to the prev/next of BP is freed
 
-    size_t prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
 
+    // bp itself is not on a list yet, but it may merge into the previous block
+    if (bp == arena->check_cursor)
+        arena->check_cursor = NULL;
+
     // TRIVIAL 0 case, push the freed block onto EFL per FILO protocol
     if (prev_alloc && next_alloc)
     {
@@ -445,9 +2561,10 @@ static void *coalesce(void *bp)
     else if (!prev_alloc && next_alloc)
     {
         efl_remove(PREV_BLKP(bp));
+        arena->stats.coalesces++;
         size = size + GET_SIZE(HDRP(PREV_BLKP(bp)));
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, PREV_ALLOC));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
         bp = PREV_BLKP(bp);
     }
 
@@ -455,13 +2572,17 @@ static void *coalesce(void *bp)
     /*
     NOTE: FTRP is calculated using the HDRP, so if we change the header to reflect the new size,
         the new FTRP would already be in the correct place.
+
+    NOTE: two free blocks are never neighbors, so whatever sits in front of the merged
+        block is allocated and its prev-allocated bit is always set
     */
     else if (prev_alloc && !next_alloc)
     {
         efl_remove(NEXT_BLKP(bp));
+        arena->stats.coalesces++;
         size = size + GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size, PREV_ALLOC));
     }
 
     // CASE 3
@@ -469,9 +2590,10 @@ static void *coalesce(void *bp)
     {
         efl_remove(PREV_BLKP(bp));
         efl_remove(NEXT_BLKP(bp));
+        arena->stats.coalesces += 2;
         size = size + GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, PREV_ALLOC));
         bp = PREV_BLKP(bp);
     }
     efl_push(bp);
@@ -480,49 +2602,115 @@ static void *coalesce(void *bp)
 
 /*
  * find_fit - Find a fit for a block with asize bytes
+ *
+ * Starts at the size class of asize, where (for the power-of-two classes)
+ * blocks may still be too small and have to be checked one by one. Every
+ * block in a higher class is bigger than anything in asize's class, so
+ * the first class that has a fit at all also holds the best fit. Past the
+ * list classes the tree is searched, which always returns the best fit
+ * whatever the placement policy.
  */
 static void *find_fit(size_t asize)
 {
+    int cls;
+    void *bp;
+
+    for (cls = size_class(asize); cls < NUM_CLASSES; cls++)
+    {
+        if ((bp = search_class(cls, asize)) != NULL)
+            return bp;
+    }
+    return tree_fit(asize); /* NULL if no fit found */
+}
+
+/*
+ * search_class - Pick a block of at least asize bytes out of class cls
+ *      according to the current placement policy
+ * @return: the chosen block, or NULL if nothing in the class fits
+ * NOTE: the exact-size classes hold blocks of a single size, so there
+ *      every policy picks the head
+ */
+static void *search_class(int cls, size_t asize)
+{
+    void *cur_block = GET_HEAD(cls);
+    void *start, *next;
+    void *best = NULL;
+    long fits = 0;
 
-    void *cur_block;
-    cur_block = GET_START;
+    if (cls < SMALL_CLASSES || !cur_block)
+        return cur_block;
 
-    while (cur_block)
+    switch (fit_policy)
     {
-        if (GET_SIZE(HDRP(cur_block)) > asize)
+    case MM_FIT_NEXT:
+        // scan from the rover to the end of the list, then wrap around to it
+        start = (arena->rover && size_class(GET_SIZE(HDRP(arena->rover))) == cls) ? arena->rover : cur_block;
+        cur_block = start;
+        do
+        {
+            next = GET_NXT_PTR(cur_block);
+            PREFETCH(next);
+            if (GET_SIZE(HDRP(cur_block)) >= asize)
+            {
+                arena->rover = next;
+                return cur_block;
+            }
+            cur_block = next ? next : GET_HEAD(cls);
+        } while (cur_block != start);
+        return NULL;
+
+    case MM_FIT_BEST:
+    case MM_FIT_BEST_OF_N:
+        for (; cur_block; cur_block = next)
+        {
+            size_t size = GET_SIZE(HDRP(cur_block));
+
+            next = GET_NXT_PTR(cur_block);
+            PREFETCH(next);
+            if (size < asize)
+                continue;
+            // an exact fit can't be beaten
+            if (size == asize)
+                return cur_block;
+            if (!best || size < GET_SIZE(HDRP(best)))
+                best = cur_block;
+            if (fit_policy == MM_FIT_BEST_OF_N && ++fits >= fit_depth)
+                break;
+        }
+        return best;
+
+    default: /* MM_FIT_FIRST */
+        for (; cur_block; cur_block = next)
         {
-            return cur_block;
+            next = GET_NXT_PTR(cur_block);
+            PREFETCH(next);
+            if (GET_SIZE(HDRP(cur_block)) >= asize)
+                return cur_block;
         }
-        cur_block = GET_NXT_PTR(cur_block);
+        return NULL;
     }
-    // for (void *cur_block = GET_START; GET_SIZE(HDRP(GET(cur_block))) > 0; cur_block = GET_NXT_PTR(cur_block))
-    // {
-    //     if (!GET_ALLOC(HDRP(cur_block)) && (asize <= GET_SIZE(HDRP(cur_block))))
-    //         return cur_block;
-    // }
-    return NULL; /* no fit found */
 }
 
 /*
  * extend_heap - Extend heap with free block and return its block pointer
  */
-static void *extend_heap(size_t words)
+static void *extend_heap(size_t size)
 {
     char *bp;
-    size_t size;
 
-    /* Allocate an even number of words to maintain alignment */
-    size = words * WSIZE;
-    if (words % 2 == 1)
-        size += WSIZE;
+    /* Round up to a multiple of the alignment to keep the payloads aligned */
+    size = ROUND_UP(size);
     // printf("extending heap to %zu bytes\n", mem_heapsize());
-    if ((long)(bp = mem_sbrk(size)) < 0)
+    if ((long)(bp = mem_arena_sbrk(arena->id, size)) < 0)
         return NULL;
+    arena->stats.sbrks++;
 
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* free block header */
-    PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+    /* Initialize free block header/footer and the epilogue header
+     * NOTE: the new block takes over the old epilogue header, whose
+     *      prev-allocated bit still describes the last block of the heap */
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)))); /* free block header */
+    PUT(FTRP(bp), GET(HDRP(bp)));                        /* free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));                /* new epilogue header */
 
     // efl_push(bp);
     // return bp;
@@ -531,53 +2719,374 @@ static void *extend_heap(size_t words)
 }
 
 /*
- * check_heap -- Performs basic heap consistency checks for an implicit free list allocator
- * and prints out all blocks in the heap in memory order.
- * Checks include proper prologue and epilogue, alignment, and matching header and footer
+ * grow_heap - Extend the heap so that it ends in a free block of at least
+ *      asize bytes, for a request that found no fit
+ *
+ * The heap grows by grow_step or by asize, whichever is bigger, but a free
+ * block already at the end of the heap counts towards that, so only the
+ * shortfall is asked for. Once the heap has grown GROW_STREAK times in a row,
+ * each time within GROW_BURST requests of the last, it is growing steadily and
+ * the step doubles with every further growth (up to GROW_MAX), so that a long
+ * run of big requests takes a few mem_sbrk calls instead of one each. After
+ * a quiet spell the step halves once for every GROW_IDLE requests, back
+ * towards CHUNKSIZE, so that an idle heap doesn't leave a big tail unused
+ * the next time it grows.
+ */
+static void *grow_heap(size_t asize)
+{
+    char *epilogue = PSUB(mem_arena_hi(arena->id), HSIZE - 1);
+    size_t last = GET_PREV_ALLOC(epilogue) ? 0 : GET_SIZE(PSUB(epilogue, HSIZE));
+    unsigned long quiet = arena->requests - arena->last_growth;
+
+    arena->growths = quiet <= GROW_BURST ? arena->growths + 1 : 0;
+    if (arena->growths >= GROW_STREAK)
+        arena->grow_step = arena->grow_step * 2 > GROW_MAX ? GROW_MAX : arena->grow_step * 2;
+    for (; quiet >= GROW_IDLE && arena->grow_step > CHUNKSIZE; quiet -= GROW_IDLE)
+        arena->grow_step /= 2;
+    arena->last_growth = arena->requests;
+
+    // no fit was found, so the last block (if free) is smaller than asize
+    return extend_heap(max(max(asize, arena->grow_step) - last, MIN_BLOCK));
+}
+
+/*
+ * check_heap -- Full consistency check of the current arena.
+ * Checks the free lists, the tree and the quick lists (see check_lists), then
+ * walks every block in memory order: proper prologue and epilogue, every block
+ * sound (see check_block) and prev-allocated bits that agree with the previous
+ * block. Finally the free blocks found on the walk have to add up to what is on
+ * the lists, so that no free block is missing from them.
  * Takes a line number (to give the output an identifying tag).
  */
 static bool check_heap(int line)
 {
     char *bp;
+    size_t prev_alloc = PREV_ALLOC; /* the prologue is allocated */
+    size_t free_blocks = 0, free_bytes = 0;
 
-    if ((GET_SIZE(HDRP(heap_start)) != DSIZE) || !GET_ALLOC(HDRP(heap_start)))
+    if ((GET_SIZE(HDRP(arena->heap_start)) != OVERHEAD) || !GET_ALLOC(HDRP(arena->heap_start)))
     {
         printf("(check_heap at line %d) Error: bad prologue header\n", line);
         return false;
     }
+    if (!check_lists(line))
+        return false;
 
-    for (bp = heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    for (bp = NEXT_BLKP(arena->heap_start); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
     {
         if (!check_block(line, bp))
         {
             return false;
         }
+        if (GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
+        {
+            printf("(check_heap at line %d) Error: %p has a stale prev-allocated bit\n", line, bp);
+            return false;
+        }
+        prev_alloc = GET_ALLOC(HDRP(bp)) ? PREV_ALLOC : 0;
+        if (!prev_alloc)
+        {
+            free_blocks++;
+            free_bytes += GET_SIZE(HDRP(bp));
+        }
     }
 
-    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
+    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))) || GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
     {
         printf("(check_heap at line %d) Error: bad epilogue header\n", line);
         return false;
     }
 
+    if (free_blocks != arena->stats.free_blocks || free_bytes != arena->stats.free_bytes)
+    {
+        printf("(check_heap at line %d) Error: %zu free blocks (%zu bytes) in the heap, %zu (%zu bytes) on the lists\n",
+               line, free_blocks, free_bytes, arena->stats.free_blocks, arena->stats.free_bytes);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * check_heap_window -- Sampled version of check_heap for long runs.
+ * Checks the lists in full, which costs as much as they are long, but walks
+ * only the next check_window blocks of the heap, starting where the previous
+ * window stopped and wrapping around at the epilogue, so that every block is
+ * visited once in a while at a bounded cost per call.
+ * NOTE: a window can't tell whether free blocks are missing from the lists as
+ *      a whole, but check_block makes sure each free block it meets is on one
+ */
+static bool check_heap_window(int line)
+{
+    char *bp = arena->check_cursor;
+    size_t prev_alloc;
+    long n;
+
+    if (!check_lists(line))
+        return false;
+    if (!bp)
+        bp = NEXT_BLKP(arena->heap_start);
+
+    // the block in front of the window is not looked at, so trust its bit
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    for (n = 0; GET_SIZE(HDRP(bp)) > 0 && n < check_window; n++, bp = NEXT_BLKP(bp))
+    {
+        if (!check_block(line, bp))
+            return false;
+        if (GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
+        {
+            printf("(check_heap at line %d) Error: %p has a stale prev-allocated bit\n", line, bp);
+            return false;
+        }
+        prev_alloc = GET_ALLOC(HDRP(bp)) ? PREV_ALLOC : 0;
+    }
+
+    if (GET_SIZE(HDRP(bp)) > 0)
+    {
+        arena->check_cursor = bp;
+        return true;
+    }
+    if (!GET_ALLOC(HDRP(bp)) || GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
+    {
+        printf("(check_heap at line %d) Error: bad epilogue header\n", line);
+        return false;
+    }
+    arena->check_cursor = NULL;
     return true;
 }
 
 /*
- * check_block -- Checks a block for alignment and matching header and footer
+ * check_sample -- Count a request, and check the current arena every
+ *      check_every requests, see mm_config(MM_CHECK)
+ * NOTE: this is meant for soak tests, so a broken heap stops the program
+ *      right where it was first noticed
+ */
+static void check_sample(void)
+{
+    if (++arena->check_ops < check_every)
+        return;
+    arena->check_ops = 0;
+    if (!(check_window ? check_heap_window(__LINE__) : check_heap(__LINE__)))
+    {
+        printf("heap check failed in arena %d\n", arena->id);
+        fflush(stdout);
+        abort();
+    }
+}
+
+/*
+ * check_block -- Checks a block for alignment and, if it is free, matching
+ * header and footer, an allocated neighbor on either side (a free neighbor
+ * means a missed coalesce) and a place on the free list of its class
  */
 static bool check_block(int line, void *bp)
 {
-    if ((size_t)bp % DSIZE)
+    if ((size_t)bp % ALIGN)
     {
-        printf("(check_heap at line %d) Error: %p is not double-word aligned\n", line, bp);
+        printf("(check_heap at line %d) Error: %p is not aligned\n", line, bp);
         return false;
     }
+    if (GET_ALLOC(HDRP(bp)))
+    {
+        if (arena->guarded && is_guarded(PADD(bp, GUARD_FRONT)) && !guard_intact(PADD(bp, GUARD_FRONT)))
+        {
+            printf("(check_heap at line %d) Error: guarded block %p was written out of bounds\n",
+                   line, PADD(bp, GUARD_FRONT));
+            return false;
+        }
+        return true;
+    }
+
     if (GET(HDRP(bp)) != GET(FTRP(bp)))
     {
         printf("(check_heap at line %d) Error: header does not match footer\n", line);
         return false;
     }
+    if (!GET_PREV_ALLOC(HDRP(bp)) || !GET_ALLOC(HDRP(NEXT_BLKP(bp))))
+    {
+        printf("(check_heap at line %d) Error: %p has a free neighbor\n", line, bp);
+        return false;
+    }
+    if (!on_list(bp))
+    {
+        printf("(check_heap at line %d) Error: free block %p is not on a list\n", line, bp);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * on_list -- Tells whether the free block bp is linked into the lists.
+ * A block with a prev link must be its prev's next. Otherwise it heads its
+ * class list, or it is the tree node for its size, which we look up by size
+ * without splaying so that checking doesn't change the tree
+ */
+static bool on_list(void *bp)
+{
+    int cls = size_class(GET_SIZE(HDRP(bp)));
+    void *node;
+
+    if (GET_PREV_PTR(bp))
+        return GET_NXT_PTR(GET_PREV_PTR(bp)) == bp;
+    if (cls != TREE_ROOT)
+        return GET_HEAD(cls) == bp;
+
+    node = GET_HEAD(TREE_ROOT);
+    while (node && GET_SIZE(HDRP(node)) != GET_SIZE(HDRP(bp)))
+        node = GET_SIZE(HDRP(bp)) < GET_SIZE(HDRP(node)) ? GET_LEFT(node) : GET_RIGHT(node);
+    return node == bp;
+}
+
+/*
+ * check_lists -- Checks every free list, the tree and the quick lists.
+ * Each block on them must be a sound free block (see check_free), linked
+ * back to its predecessor, and the totals must agree with the counters kept
+ * for mm_stats. The walk gives up once it has seen more blocks than there
+ * are free blocks, so a cycle is reported rather than followed forever.
+ */
+static bool check_lists(int line)
+{
+    int cls, w;
+    void *bp, *prev;
+    long left = (long)arena->stats.free_blocks; /* blocks the walk may still visit */
+    size_t bytes = 0;
+    int parked = 0;
+    int regions, hinted;
+
+    for (cls = 0; cls < NUM_CLASSES; cls++)
+    {
+        regions = 0;
+        for (prev = NULL, bp = GET_HEAD(cls); bp; prev = bp, bp = GET_NXT_PTR(bp))
+        {
+            if (--left < 0)
+            {
+                printf("(check_heap at line %d) Error: class %d has a cycle\n", line, cls);
+                return false;
+            }
+            if (!check_free(line, bp, cls) || GET_PREV_PTR(bp) != prev)
+            {
+                printf("(check_heap at line %d) Error: bad block %p on class %d\n", line, bp, cls);
+                return false;
+            }
+            bytes += GET_SIZE(HDRP(bp));
+
+            // in address order the list is sorted, and the first block of each region is its hint
+            if (list_order != MM_ORDER_ADDRESS || (prev && HINT_REGION(prev) == HINT_REGION(bp) && prev < bp))
+                continue;
+            if ((prev && prev >= bp) || arena->hints[cls][HINT_REGION(bp)] != bp)
+            {
+                printf("(check_heap at line %d) Error: class %d is out of order at %p\n", line, cls, bp);
+                return false;
+            }
+            regions++;
+        }
+
+        for (w = 0, hinted = 0; w < HINT_WORDS; w++)
+            hinted += __builtin_popcountl(arena->hint_map[cls][w]);
+        if (list_order == MM_ORDER_ADDRESS && hinted != regions)
+        {
+            printf("(check_heap at line %d) Error: class %d has %d hints for %d regions\n", line, cls, hinted, regions);
+            return false;
+        }
+    }
+    if (!check_node(line, GET_HEAD(TREE_ROOT), TREE_MIN - 1, (size_t)-1, &left, &bytes))
+        return false;
+
+    if (left != 0 || bytes != arena->stats.free_bytes)
+    {
+        printf("(check_heap at line %d) Error: %zu blocks (%zu bytes) are counted, %ld (%zu bytes) are on the lists\n",
+               line, arena->stats.free_blocks, arena->stats.free_bytes,
+               (long)arena->stats.free_blocks - left, bytes);
+        return false;
+    }
+
+    // parked blocks still look allocated, and carry the quick bit
+    for (cls = 0, bytes = 0; cls < QUICK_LISTS; cls++)
+    {
+        for (bp = GET_QUICK(cls); bp; bp = GET_PREV_PTR(bp))
+        {
+            if (++parked > arena->quick_count)
+            {
+                printf("(check_heap at line %d) Error: quick list %d has a cycle\n", line, cls);
+                return false;
+            }
+            if (!GET_ALLOC(HDRP(bp)) || !GET_QUICK_BIT(HDRP(bp)) || size_class(GET_SIZE(HDRP(bp))) != cls)
+            {
+                printf("(check_heap at line %d) Error: bad block %p on quick list %d\n", line, bp, cls);
+                return false;
+            }
+            bytes += GET_SIZE(HDRP(bp));
+        }
+    }
+    if (parked != arena->quick_count || bytes != arena->stats.parked_bytes)
+    {
+        printf("(check_heap at line %d) Error: %d blocks are parked, %d are counted\n",
+               line, parked, arena->quick_count);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * check_node -- Checks the subtree at node: sizes strictly between lo and hi
+ * (so the tree is ordered and holds each size once), tree nodes with a NULL
+ * prev link, and behind each node a list of sound blocks of the same size.
+ * Visited blocks are taken off *left and their sizes added to *bytes
+ */
+static bool check_node(int line, void *node, size_t lo, size_t hi, long *left, size_t *bytes)
+{
+    void *bp, *prev;
+    size_t size;
+
+    if (!node)
+        return true;
+    if (--*left < 0)
+    {
+        printf("(check_heap at line %d) Error: the tree has a cycle\n", line);
+        return false;
+    }
+    size = GET_SIZE(HDRP(node));
+    if (!check_free(line, node, TREE_ROOT) || GET_PREV_PTR(node) || size <= lo || size >= hi)
+    {
+        printf("(check_heap at line %d) Error: bad tree node %p\n", line, node);
+        return false;
+    }
+    *bytes += size;
+
+    for (prev = node, bp = GET_NXT_PTR(node); bp; prev = bp, bp = GET_NXT_PTR(bp))
+    {
+        if (--*left < 0)
+        {
+            printf("(check_heap at line %d) Error: the list of tree node %p has a cycle\n", line, node);
+            return false;
+        }
+        if (!check_free(line, bp, TREE_ROOT) || GET_PREV_PTR(bp) != prev || GET_SIZE(HDRP(bp)) != size)
+        {
+            printf("(check_heap at line %d) Error: bad block %p behind tree node %p\n", line, bp, node);
+            return false;
+        }
+        *bytes += size;
+    }
+    return check_node(line, GET_LEFT(node), lo, size, left, bytes) &&
+           check_node(line, GET_RIGHT(node), size, hi, left, bytes);
+}
+
+/*
+ * check_free -- Checks that bp, found on a list of class cls, points into the
+ * heap and is a free block of that class with matching header and footer
+ */
+static bool check_free(int line, void *bp, int cls)
+{
+    if ((char *)bp <= (char *)arena->heap_start || (char *)bp > (char *)mem_arena_hi(arena->id) ||
+        (size_t)bp % ALIGN)
+    {
+        printf("(check_heap at line %d) Error: %p is not a block of the heap\n", line, bp);
+        return false;
+    }
+    if (GET_ALLOC(HDRP(bp)) || GET(HDRP(bp)) != GET(FTRP(bp)) || size_class(GET_SIZE(HDRP(bp))) != cls)
+    {
+        printf("(check_heap at line %d) Error: %p is allocated or in the wrong class\n", line, bp);
+        return false;
+    }
     return true;
 }
 
@@ -587,7 +3096,7 @@ static bool check_block(int line, void *bp)
 static void print_heap()
 {
     char *bp;
-    for (bp = heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    for (bp = arena->heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
     {
         print_block(bp);
     }
@@ -604,8 +3113,6 @@ static void print_block(void *bp)
 
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp));
 
     if (hsize == 0)
     {
@@ -613,11 +3120,35 @@ static void print_block(void *bp)
         return;
     }
 
+    if (halloc)
+    {
+        printf("%p: header: [%ld:a] prev: %c\n", bp,
+               hsize, (GET_PREV_ALLOC(HDRP(bp)) ? 'a' : 'f'));
+        return;
+    }
+
+    fsize = GET_SIZE(FTRP(bp));
+    falloc = GET_ALLOC(FTRP(bp));
+
     printf("%p: header: [%ld:%c] footer: [%ld:%c]\n", bp,
            hsize, (halloc ? 'a' : 'f'),
            fsize, (falloc ? 'a' : 'f'));
 }
 
+/*
+ * adjust_size: returns the block size needed for a payload of size bytes
+ * NOTE: an allocated block only has a header, but it has to be able to
+ *      hold the links and footer once it is freed again
+ */
+static size_t adjust_size(size_t size)
+{
+    if (size <= MIN_BLOCK - ALLOC_OVERHEAD)
+        return MIN_BLOCK;
+
+    /* Add overhead and then round up to nearest multiple of the alignment */
+    return ROUND_UP(size + ALLOC_OVERHEAD);
+}
+
 /*
  * max: returns x if x > y, and y otherwise.
  */
@@ -625,3 +3156,21 @@ static size_t max(size_t x, size_t y)
 {
     return (x > y) ? x : y;
 }
+
+#if MM_LINK_BITS == 32
+/*
+ * link_to_ptr: returns the block a compressed link points to, or NULL for 0
+ */
+static void *link_to_ptr(unsigned int link)
+{
+    return link ? PADD(arena->heap_start, link) : NULL;
+}
+
+/*
+ * ptr_to_link: returns the compressed link to block bp of the current arena
+ */
+static unsigned int ptr_to_link(void *bp)
+{
+    return bp ? (unsigned int)((char *)bp - (char *)arena->heap_start) : 0;
+}
+#endif
@@ -4,6 +4,76 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_config(int param, long value);
+extern long mm_guard_mask(void);
+extern int mm_check(void);
+
+/*
+ * Free blocks are counted per size class: in the default build classes 0 to
+ * 29 hold blocks of exactly 32, 48, ... 496 bytes, class 30 blocks of 512 to
+ * 1023 bytes and class 31 (the tree) everything bigger. Builds with another
+ * block layout use other classes: with 16-byte blocks (32-bit headers and
+ * links) there is one more exact class and the tree is class 32
+ */
+#define MM_NUM_CLASSES 33
+
+/*
+ * Counters kept by the mm package as it goes, so reading them never walks
+ * the heap. Sizes are block sizes in bytes, headers included.
+ */
+typedef struct {
+    size_t heap_bytes;    /* bytes obtained with mem_sbrk and not given back */
+    size_t mapped_bytes;  /* bytes in mapped regions */
+    size_t live_bytes;    /* bytes of blocks handed out and not freed yet */
+    size_t free_bytes;    /* bytes of free blocks on the free lists */
+    size_t free_blocks;   /* number of free blocks on the free lists */
+    size_t class_blocks[MM_NUM_CLASSES]; /* free_blocks by size class */
+    size_t largest_free;  /* size of the biggest free block */
+    size_t slack_bytes;   /* bytes of the free block at the end of the heap */
+    size_t parked_bytes;  /* bytes of blocks waiting for a deferred coalesce */
+    size_t parked_blocks; /* number of those blocks */
+    unsigned long splits;    /* free blocks split to place a block */
+    unsigned long coalesces; /* free blocks merged with a neighbor */
+    unsigned long sbrks;     /* mem_sbrk calls that grew or shrank the heap */
+    unsigned long reallocs_in_place; /* mm_realloc calls that kept the block where it was */
+    unsigned long reallocs_moved;    /* mm_realloc calls that had to copy the block */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/*
+ * Parameters accepted by mm_config. Settings survive mm_init, so a
+ * driver can pick them once and then run any number of traces.
+ */
+#define MM_FIT_POLICY 0 /* placement policy, one of MM_FIT_xxx below */
+#define MM_FIT_DEPTH  1 /* candidates examined by MM_FIT_BEST_OF_N */
+#define MM_SLAB       2 /* nonzero to serve tiny requests from slab runs */
+#define MM_COALESCE   3 /* when mm_free coalesces, one of MM_COALESCE_xxx below */
+#define MM_TRIM       4 /* size of a free heap end that is given back, 0 never */
+#define MM_MAP        5 /* requests this big get a mapped region, 0 never */
+#define MM_CHECK      6 /* check the heap every this many requests, 0 never */
+#define MM_CHECK_WINDOW 7 /* blocks of the heap walked per check, 0 all of them */
+#define MM_ORDER      8 /* order of the free lists, one of MM_ORDER_xxx below */
+#define MM_REALLOC_SLACK 9 /* nonzero to reserve room after blocks that realloc grows */
+#define MM_GUARD     10 /* bit mask of the size classes (numbered like class_blocks,
+                           for the block size of the request) whose blocks end at a
+                           guard page, -1 all of them, 0 none. Setting it returns 0,
+                           mm_guard_mask reads it back */
+
+/* Placement policies for MM_FIT_POLICY */
+#define MM_FIT_FIRST     0 /* first block that fits */
+#define MM_FIT_NEXT      1 /* first fit, resuming where the last search stopped */
+#define MM_FIT_BEST      2 /* smallest block that fits */
+#define MM_FIT_BEST_OF_N 3 /* smallest of the first MM_FIT_DEPTH fits */
+#define MM_NUM_FITS      4
+
+/* Coalescing modes for MM_COALESCE */
+#define MM_COALESCE_IMMEDIATE 0 /* coalesce on every free */
+#define MM_COALESCE_DEFERRED  1 /* park freed blocks on quick lists, coalesce in batches */
+
+/* List orders for MM_ORDER */
+#define MM_ORDER_LIFO    0 /* a freed block goes to the head of its list */
+#define MM_ORDER_ADDRESS 1 /* lists are sorted by address, so fits come from low addresses */
 
 
 /* 
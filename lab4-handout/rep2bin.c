@@ -0,0 +1,99 @@
+/*
+ * rep2bin.c - Convert a .rep trace to the binary form of trace.h
+ *
+ * usage: rep2bin <in.rep> <out.bin>
+ *
+ * The requests are checked the way read_trace checks them (every id in
+ * range, as many requests as the header says) and written out as they
+ * are read, so a trace of any size converts in constant memory. mdriver
+ * tells the two forms apart by their first bytes, so a converted trace
+ * is run like any other, e.g. mdriver -f out.bin.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+static void fail(char *msg, char *outname);
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    trace_hdr_t hdr;
+    traceop_t op;
+    char type[MAXLINE];
+    int max_index = -1;
+    int scan_result = 1;
+    int n;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <in.rep> <out.bin>\n", argv[0]);
+        exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+    if ((out = fopen(argv[2], "w")) == NULL) {
+        perror(argv[2]);
+        exit(1);
+    }
+
+    /* The header carries over as it is */
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    scan_result = scan_result && fscanf(in, "%d", &hdr.sugg_heapsize) == 1;
+    scan_result = scan_result && fscanf(in, "%d", &hdr.num_ids) == 1;
+    scan_result = scan_result && fscanf(in, "%d", &hdr.num_ops) == 1;
+    scan_result = scan_result && fscanf(in, "%d", &hdr.weight) == 1;
+    if (!scan_result || hdr.num_ids < 0 || hdr.num_ops < 0)
+        fail("Error scanning metadata at the start of the trace", argv[2]);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+        fail("Error writing the header", argv[2]);
+
+    /* Then one record per request line */
+    for (n = 0; fscanf(in, "%s", type) != EOF; n++) {
+        memset(&op, 0, sizeof(op));
+        switch (type[0]) {
+        case 'a':
+        case 'r':
+            op.type = type[0] == 'a' ? ALLOC : REALLOC;
+            scan_result = fscanf(in, "%d %d", &op.index, &op.size) == 2 && op.size >= 0;
+            max_index = op.index > max_index ? op.index : max_index;
+            break;
+        case 'f':
+            op.type = FREE;
+            scan_result = fscanf(in, "%d", &op.index) == 1;
+            break;
+        default:
+            scan_result = 0;
+        }
+        if (!scan_result || op.index < 0 || op.index >= hdr.num_ids || n >= hdr.num_ops) {
+            fprintf(stderr, "Bad request %d (line %d)\n", n, n + 5);
+            fail("Error scanning the requests", argv[2]);
+        }
+        if (fwrite(&op, sizeof(op), 1, out) != 1)
+            fail("Error writing a request", argv[2]);
+    }
+    if (n != hdr.num_ops || max_index != hdr.num_ids - 1)
+        fail("The header doesn't match the requests", argv[2]);
+
+    fclose(in);
+    if (fclose(out) != 0)
+        fail("Error writing the trace", argv[2]);
+    return 0;
+}
+
+/*
+ * fail - report a bad input or output, and don't leave half a trace behind
+ */
+static void fail(char *msg, char *outname)
+{
+    fprintf(stderr, "rep2bin: %s\n", msg);
+    remove(outname);
+    exit(1);
+}
@@ -0,0 +1,42 @@
+/*
+ * trace.h - The binary trace format, shared by mdriver and rep2bin
+ *
+ * A .rep trace is text, which mdriver has to parse token by token and
+ * copy into memory before it can run it. A binary trace holds the same
+ * requests as fixed-width records, laid out exactly like the array that
+ * read_trace builds, so mdriver maps the file and uses the records where
+ * they are. They are never parsed or copied, only checked once as the
+ * trace is loaded, so that a bad index or type is rejected up front.
+ *
+ *  ------------------------------------------------------------
+ * | trace_hdr_t | traceop_t 0 | traceop_t 1 | ... | num_ops-1 |
+ *  ------------------------------------------------------------
+ *
+ * Everything is in native byte order. A file written on a machine of the
+ * other byte order doesn't start with TRACE_MAGIC as read here, so it is
+ * rejected rather than misread. rep2bin converts .rep files to this form.
+ */
+
+#define TRACE_MAGIC   0x4d4d5442 /* "MMTB" */
+#define TRACE_VERSION 1
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* The start of a binary trace, the four numbers of a .rep header follow
+   the magic and version */
+typedef struct {
+    int magic;           /* TRACE_MAGIC */
+    int version;         /* TRACE_VERSION */
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of requests, and of records */
+    int weight;          /* weight for this trace (unused) */
+} trace_hdr_t;
+
+_Static_assert(sizeof(traceop_t) == 12, "trace records are three 32-bit words");
+_Static_assert(sizeof(trace_hdr_t) % sizeof(int) == 0, "records must stay aligned");
@@ -0,0 +1,586 @@
+/*
+ * tracegen.c - Generate synthetic traces for mdriver
+ *
+ * usage: tracegen [options] -o <out.rep>
+ *
+ * A trace is a sequence of phases. Each phase makes a number of
+ * allocations whose sizes and lifetimes come from distributions, some
+ * of which grow by a chain of reallocs before they die, and some of
+ * which are freed in the order they were made (producer/consumer)
+ * rather than when their lifetime runs out. Options set the phase
+ * being built; -P closes it, and the next phase starts out with the
+ * same settings, so a phase change only names what changes:
+ *
+ *   -n <count>       allocations in the phase (default 10000)
+ *   -s <dist>        request sizes in bytes (default lognormal:4,1)
+ *   -l <dist>        lifetimes, counted in allocations (default exp:200)
+ *   -r <p>:<n>:<g>   a fraction p of the blocks is reallocated n times,
+ *                    growing by a factor g each time (default none)
+ *   -q <p>:<depth>   a fraction p of the blocks goes through a queue and
+ *                    is freed once depth newer ones wait behind it
+ *   -f <frac>        when the phase ends, free this fraction of its live
+ *                    blocks, those due to die first (default 0)
+ *   -P               end the phase and start the next one
+ *
+ * and these apply to the whole trace:
+ *
+ *   -o <file>        output file (required)
+ *   -b               write the binary form of trace.h instead of .rep
+ *   -S <seed>        seed of the random numbers (default 1)
+ *   -m <bytes>       most live payload bytes, blocks due to die first are
+ *                    freed early to stay below (default 8 MB, so that the
+ *                    trace fits in mdriver's heap); no request is bigger
+ *
+ * A distribution <dist> is one of
+ *   fixed:v                 always v
+ *   uniform:lo,hi           uniform between lo and hi
+ *   exp:mean                exponential
+ *   lognormal:mu,sigma      e^N(mu, sigma), heavy tailed, typical of sizes
+ *   bimodal:a,b,p           a or (with probability p) b, give or take 25%
+ *   powerlaw:alpha,lo,hi    P(x) ~ x^-alpha between lo and hi
+ *
+ * Every block still live at the end is freed, so traces are balanced
+ * like the -bal.rep ones. For example, a server whose requests allocate
+ * small buffers, grow a response and hand messages to a worker:
+ *
+ *   tracegen -n 200000 -s lognormal:4,1.2 -l exp:500 -r 0.02:6:1.5 \
+ *            -q 0.1:2000 -f 0.9 -P -s bimodal:64,16384,0.05 -o srv.rep
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <limits.h>
+
+#include "trace.h"
+
+#define MAX_PHASES 64
+
+/* A distribution picked with -s or -l */
+typedef struct {
+    enum {FIXED, UNIFORM, EXP, LOGNORMAL, BIMODAL, POWERLAW} kind;
+    double a, b, c;            /* its parameters, in the order they are written */
+} dist_t;
+
+/* The settings of one phase */
+typedef struct {
+    long count;                /* allocations */
+    dist_t size;               /* request sizes (bytes) */
+    dist_t life;               /* lifetimes (allocations) */
+    double realloc_p;          /* fraction of blocks with a realloc chain */
+    int realloc_n;             /* reallocs in a chain */
+    double realloc_g;          /* growth factor of each realloc */
+    double queue_p;            /* fraction of blocks freed in FIFO order */
+    long queue_depth;          /* blocks waiting in the queue */
+    double flush;              /* fraction of live blocks freed at the end */
+} phase_t;
+
+/* A live block */
+typedef struct {
+    long due;                  /* time of its next event */
+    int id;                    /* its id in the trace */
+    int size;                  /* its current size */
+    int reallocs;              /* reallocs still to come */
+    long gap;                  /* time between two of them */
+    double growth;             /* and the factor each one grows it by */
+} block_t;
+
+/* The trace built so far */
+static traceop_t *ops;
+static long num_ops, max_ops;
+static int num_ids;
+static long live_bytes, peak_bytes;
+static long max_live = 8 << 20;
+
+/* Live blocks by time of their next event, a binary min-heap... */
+static block_t *heap;
+static long heap_len, heap_max;
+
+/* ...and the blocks waiting in the queue, oldest first in a ring buffer */
+static block_t *queue;
+static long queue_head, queue_len, queue_max;
+
+static unsigned long long rng_state = 1;
+
+static void parse_dist(char *arg, dist_t *dist);
+static void parse_triple(char *arg, int fields, double *x, double *y, double *z);
+static double sample(dist_t *dist);
+static double uniform01(void);
+static double normal01(void);
+static void emit(int type, int id, int size);
+static void heap_push(block_t *b);
+static block_t heap_pop(void);
+static void queue_push(block_t *b);
+static block_t queue_pop(void);
+static void free_block(block_t *b);
+static int clamp_size(double size);
+static void cap_live(long more);
+static void run_phase(phase_t *p, long *now);
+static void write_trace(char *path, int binary);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    phase_t phases[MAX_PHASES];
+    int num_phases = 0;
+    char *outname = NULL;
+    int binary = 0;
+    long now = 0;
+    double n, d;
+    int c, i;
+
+    /* the defaults of the first phase */
+    memset(&phases[0], 0, sizeof(phases[0]));
+    phases[0].count = 10000;
+    parse_dist("lognormal:4,1", &phases[0].size);
+    parse_dist("exp:200", &phases[0].life);
+
+    while ((c = getopt(argc, argv, "n:s:l:r:q:f:Po:bS:m:h")) != EOF) {
+        phase_t *p = &phases[num_phases];
+
+        switch (c) {
+        case 'n':
+            p->count = atol(optarg);
+            break;
+        case 's':
+            parse_dist(optarg, &p->size);
+            break;
+        case 'l':
+            parse_dist(optarg, &p->life);
+            break;
+        case 'r':
+            parse_triple(optarg, 3, &p->realloc_p, &n, &p->realloc_g);
+            p->realloc_n = (int)n;
+            break;
+        case 'q':
+            parse_triple(optarg, 2, &p->queue_p, &d, &n);
+            p->queue_depth = (long)d;
+            break;
+        case 'f':
+            p->flush = atof(optarg);
+            break;
+        case 'P':
+            if (num_phases + 1 == MAX_PHASES) {
+                fprintf(stderr, "tracegen: at most %d phases\n", MAX_PHASES);
+                exit(1);
+            }
+            phases[num_phases + 1] = *p;
+            phases[num_phases + 1].flush = 0;
+            num_phases++;
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        case 'b':
+            binary = 1;
+            break;
+        case 'S':
+            rng_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+        case 'm':
+            max_live = (long)strtod(optarg, NULL);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    num_phases++;
+    if (outname == NULL) {
+        usage();
+        exit(1);
+    }
+
+    for (i = 0; i < num_phases; i++)
+        run_phase(&phases[i], &now);
+
+    /* free whatever is left, the queue in order and the rest by due time */
+    while (queue_len > 0) {
+        block_t b = queue_pop();
+        free_block(&b);
+    }
+    while (heap_len > 0) {
+        block_t b = heap_pop();
+        free_block(&b);
+    }
+
+    write_trace(outname, binary);
+    return 0;
+}
+
+/*
+ * run_phase - Make the allocations of phase p, and whatever reallocs and
+ *     frees fall due in the meantime. Time counts allocations
+ */
+static void run_phase(phase_t *p, long *now)
+{
+    long i, end = *now + p->count, keep;
+    block_t b;
+
+    for (; *now < end; (*now)++) {
+        /* first everything that is due */
+        while (heap_len > 0 && heap[0].due <= *now) {
+            b = heap_pop();
+            if (b.reallocs > 0) {
+                int old = b.size;
+
+                b.size = clamp_size((double)b.size * b.growth + 1);
+                cap_live(b.size - old);
+                live_bytes += b.size - old;
+                peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+                emit(REALLOC, b.id, b.size);
+                b.reallocs--;
+                b.due = *now + b.gap;
+                heap_push(&b);
+            }
+            else
+                free_block(&b);
+        }
+
+        /* then the new block */
+        b.id = num_ids++;
+        b.size = clamp_size(sample(&p->size));
+        b.reallocs = 0;
+        cap_live(b.size);
+        emit(ALLOC, b.id, b.size);
+        live_bytes += b.size;
+        peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+
+        if (p->queue_p > 0 && uniform01() < p->queue_p) {
+            queue_push(&b);
+            if (queue_len > p->queue_depth) {
+                b = queue_pop();
+                free_block(&b);
+            }
+            continue;
+        }
+        b.due = *now + 1 + (long)sample(&p->life);
+        if (p->realloc_p > 0 && uniform01() < p->realloc_p) {
+            /* the chain spreads over the lifetime of the block */
+            b.reallocs = p->realloc_n;
+            b.growth = p->realloc_g;
+            b.gap = (b.due - *now) / (p->realloc_n + 1) + 1;
+            b.due = *now + b.gap;
+        }
+        heap_push(&b);
+    }
+
+    /* the end of a phase may take most of its blocks with it */
+    for (keep = heap_len - (long)(p->flush * heap_len), i = heap_len; i > keep; i--) {
+        b = heap_pop();
+        free_block(&b);
+    }
+}
+
+/*
+ * clamp_size - Round a drawn or grown size to a request size: at least 1,
+ *     and no more than the live bytes limit or what an int holds
+ */
+static int clamp_size(double size)
+{
+    double most = max_live < INT_MAX ? max_live : INT_MAX;
+
+    if (most < 1)
+        most = 1;
+    return size < 1 ? 1 : size > most ? (int)most : (int)size;
+}
+
+/*
+ * cap_live - Make room for more live bytes below the limit, before the
+ *     request that adds them, by freeing the blocks due to die first
+ *     early. Queued blocks wait their turn
+ */
+static void cap_live(long more)
+{
+    block_t b;
+
+    while (live_bytes + more > max_live && heap_len > 0) {
+        b = heap_pop();
+        free_block(&b);
+    }
+}
+
+/*
+ * free_block - Free block b in the trace
+ */
+static void free_block(block_t *b)
+{
+    emit(FREE, b->id, 0);
+    live_bytes -= b->size;
+}
+
+/*
+ * emit - Append a request to the trace
+ */
+static void emit(int type, int id, int size)
+{
+    if (num_ops == max_ops) {
+        max_ops = max_ops ? 2 * max_ops : 1 << 16;
+        if ((ops = realloc(ops, max_ops * sizeof(traceop_t))) == NULL) {
+            fprintf(stderr, "tracegen: out of memory for %ld requests\n", max_ops);
+            exit(1);
+        }
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * heap_push - Add b to the live blocks
+ */
+static void heap_push(block_t *b)
+{
+    long i, parent;
+
+    if (heap_len == heap_max) {
+        heap_max = heap_max ? 2 * heap_max : 1024;
+        if ((heap = realloc(heap, heap_max * sizeof(block_t))) == NULL) {
+            fprintf(stderr, "tracegen: out of memory for %ld live blocks\n", heap_max);
+            exit(1);
+        }
+    }
+
+    /* sift up from the end */
+    for (i = heap_len++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (heap[parent].due <= b->due)
+            break;
+        heap[i] = heap[parent];
+    }
+    heap[i] = *b;
+}
+
+/*
+ * heap_pop - Take the live block whose next event comes first
+ */
+static block_t heap_pop(void)
+{
+    block_t top = heap[0], last = heap[--heap_len];
+    long i, child;
+
+    /* sift the last block down from the root */
+    for (i = 0; (child = 2 * i + 1) < heap_len; i = child) {
+        if (child + 1 < heap_len && heap[child + 1].due < heap[child].due)
+            child++;
+        if (last.due <= heap[child].due)
+            break;
+        heap[i] = heap[child];
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * queue_push - Put b at the back of the queue
+ */
+static void queue_push(block_t *b)
+{
+    long i;
+
+    if (queue_len == queue_max) {
+        block_t *bigger;
+        long bigger_max = queue_max ? 2 * queue_max : 1024;
+
+        if ((bigger = malloc(bigger_max * sizeof(block_t))) == NULL) {
+            fprintf(stderr, "tracegen: out of memory for %ld queued blocks\n", bigger_max);
+            exit(1);
+        }
+        /* unwrap the ring as it is copied */
+        for (i = 0; i < queue_len; i++)
+            bigger[i] = queue[(queue_head + i) % queue_max];
+        free(queue);
+        queue = bigger;
+        queue_max = bigger_max;
+        queue_head = 0;
+    }
+    queue[(queue_head + queue_len++) % queue_max] = *b;
+}
+
+/*
+ * queue_pop - Take the block at the front of the queue
+ */
+static block_t queue_pop(void)
+{
+    block_t b = queue[queue_head];
+
+    queue_head = (queue_head + 1) % queue_max;
+    queue_len--;
+    return b;
+}
+
+/*
+ * parse_dist - Read a distribution written as name:params
+ */
+static void parse_dist(char *arg, dist_t *dist)
+{
+    static const struct {
+        char *name;
+        int kind, params;
+    } dists[] = {
+        {"fixed", FIXED, 1}, {"uniform", UNIFORM, 2}, {"exp", EXP, 1},
+        {"lognormal", LOGNORMAL, 2}, {"bimodal", BIMODAL, 3},
+        {"powerlaw", POWERLAW, 3},
+    };
+    char *params = strchr(arg, ':');
+    size_t len = params ? (size_t)(params - arg) : strlen(arg);
+    unsigned i;
+    int n;
+
+    for (i = 0; i < sizeof(dists) / sizeof(dists[0]); i++) {
+        if (strlen(dists[i].name) != len || strncmp(arg, dists[i].name, len) != 0)
+            continue;
+        dist->a = dist->b = dist->c = 0;
+        n = params ? sscanf(params + 1, "%lf,%lf,%lf", &dist->a, &dist->b, &dist->c) : 0;
+        if (n != dists[i].params)
+            break;
+        dist->kind = dists[i].kind;
+        if (dist->kind == POWERLAW && (dist->a <= 1 || dist->b <= 0 || dist->c <= dist->b))
+            break;
+        return;
+    }
+    fprintf(stderr, "tracegen: bad distribution %s\n", arg);
+    exit(1);
+}
+
+/*
+ * parse_triple - Read the numbers of -r (x:y:z) and -q (x:y), all of them
+ */
+static void parse_triple(char *arg, int fields, double *x, double *y, double *z)
+{
+    if (sscanf(arg, "%lf:%lf:%lf", x, y, z) != fields || *x < 0 || *x > 1 || *y < 0 ||
+        (fields == 3 && *z <= 0)) {
+        fprintf(stderr, "tracegen: bad argument %s\n", arg);
+        exit(1);
+    }
+}
+
+/*
+ * sample - Draw a number from a distribution
+ */
+static double sample(dist_t *dist)
+{
+    double u, x;
+
+    switch (dist->kind) {
+    case FIXED:
+        return dist->a;
+    case UNIFORM:
+        return dist->a + (dist->b - dist->a) * uniform01();
+    case EXP:
+        return -dist->a * log(1 - uniform01());
+    case LOGNORMAL:
+        return exp(dist->a + dist->b * normal01());
+    case BIMODAL:
+        x = uniform01() < dist->c ? dist->b : dist->a;
+        return x * (0.75 + 0.5 * uniform01());
+    case POWERLAW:
+        /* invert the CDF of the Pareto distribution cut off at hi */
+        u = uniform01();
+        x = pow(dist->b, 1 - dist->a) * (1 - u) + pow(dist->c, 1 - dist->a) * u;
+        return pow(x, 1 / (1 - dist->a));
+    }
+    return 0;
+}
+
+/*
+ * uniform01 - A uniform random number in [0, 1), from xorshift64*, so that
+ *     a seed gives the same trace everywhere
+ */
+static double uniform01(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * normal01 - A standard normal random number, by Box-Muller
+ */
+static double normal01(void)
+{
+    double u = uniform01(), v = uniform01();
+
+    return sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+}
+
+/*
+ * write_trace - Write the trace to path, as .rep text or in binary
+ */
+static void write_trace(char *path, int binary)
+{
+    FILE *out;
+    trace_hdr_t hdr;
+    long i;
+    int ok = 1;
+
+    if (num_ops > 0x7fffffff) {
+        fprintf(stderr, "tracegen: %ld requests don't fit in a trace\n", num_ops);
+        exit(1);
+    }
+    if ((out = fopen(path, "w")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.sugg_heapsize = peak_bytes > 0x7fffffff ? 0x7fffffff : (int)peak_bytes;
+    hdr.num_ids = num_ids;
+    hdr.num_ops = (int)num_ops;
+    hdr.weight = 1;
+
+    if (binary) {
+        ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1
+            && fwrite(ops, sizeof(traceop_t), num_ops, out) == (size_t)num_ops;
+    }
+    else {
+        fprintf(out, "%d\n%d\n%d\n%d\n", hdr.sugg_heapsize, hdr.num_ids,
+                hdr.num_ops, hdr.weight);
+        for (i = 0; i < num_ops; i++) {
+            if (ops[i].type == ALLOC)
+                fprintf(out, "a %d %d\n", ops[i].index, ops[i].size);
+            else if (ops[i].type == REALLOC)
+                fprintf(out, "r %d %d\n", ops[i].index, ops[i].size);
+            else
+                fprintf(out, "f %d\n", ops[i].index);
+        }
+    }
+    if (fclose(out) != 0 || !ok) {
+        fprintf(stderr, "tracegen: error writing %s\n", path);
+        remove(path);
+        exit(1);
+    }
+    printf("%s: %d ids, %d requests, %ld bytes live at most\n",
+           path, hdr.num_ids, hdr.num_ops, peak_bytes);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [phase options] [-P [phase options]]... -o <file>\n");
+    fprintf(stderr, "Phase options (each phase starts from the previous one's):\n");
+    fprintf(stderr, "\t-n <count>      Allocations in the phase.\n");
+    fprintf(stderr, "\t-s <dist>       Sizes of the requests.\n");
+    fprintf(stderr, "\t-l <dist>       Lifetimes, in allocations.\n");
+    fprintf(stderr, "\t-r <p>:<n>:<g>  Fraction p of blocks realloc'd n times, by a factor g.\n");
+    fprintf(stderr, "\t-q <p>:<depth>  Fraction p of blocks freed in FIFO order behind depth others.\n");
+    fprintf(stderr, "\t-f <frac>       Free this fraction of the live blocks when the phase ends.\n");
+    fprintf(stderr, "\t-P              Start the next phase.\n");
+    fprintf(stderr, "Trace options:\n");
+    fprintf(stderr, "\t-o <file>       Write the trace to <file>.\n");
+    fprintf(stderr, "\t-b              Write it in binary rather than as .rep text.\n");
+    fprintf(stderr, "\t-S <seed>       Seed the random numbers.\n");
+    fprintf(stderr, "\t-m <bytes>      Free blocks early to keep fewer live bytes than this.\n");
+    fprintf(stderr, "Distributions: fixed:v uniform:lo,hi exp:mean lognormal:mu,sigma\n");
+    fprintf(stderr, "\tbimodal:a,b,p powerlaw:alpha,lo,hi\n");
+}